@@ -1,40 +1,29 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
+#include "batch_runner.h"
+#include "benchmarks.h"
 #include "board.h"
+#include "board_t.h"
+#include "coro_search.h"
+#include "distributed_runner.h"
+#include "game_analysis.h"
+#include "large_pages.h"
 #include "rng.h"
+#include "mcts_player.h"
+#include "opening_book.h"
+#include "position_suite.h"
 #include "random_player.h"
 #include "search_player.h"
+#include "search_player_t.h"
+#include "trace.h"
 #include "unit_tests.h"
 
 static const double CPMS = CLOCKS_PER_SEC / 1000.0;
 
-void TimeMoveSpeed()
-{
-  Board b;
-  b.SetRow(0, 0,1,1,0);
-  b.SetRow(1, 2,2,0,0);
-  b.SetRow(2, 1,0,0,1);
-  b.SetRow(3, 0,0,0,3);  
-
-  clock_t start = clock();
-  const int NumIters = 1000000;
-  int score = 0;
-  for (int i = 0; i < NumIters; ++i) {    
-    Board c;
-    c = b; c.Slide(Up); score += c.score;
-    c = b; c.Slide(Right); score += c.score;
-    c = b; c.Slide(Down); score += c.score;
-    c = b; c.Slide(Left); score += c.score;
-  }
-  clock_t stop = clock();
-  printf("Score: %d\n", score);
-  printf("Iterations: %d\n", NumIters);
-  printf("Time: %0.1fms\n", (stop-start)/CPMS);
-}
-
 Board NewGame(RNG& rng)
 {
   Board b;
@@ -51,6 +40,7 @@ void PlayGame(Player* player)
   //Board board;
   //board.SetRow(3, 5,7,9,12);
 
+  player->NewGame();
   clock_t start = clock();
   int nMoves = 0;
   while (true) {
@@ -74,17 +64,237 @@ void PlayGame(Player* player)
   printf("Final Board (%d moves):\n", nMoves);
   board.Print();
   printf("%d  %d\n", 1 << board.MaxTile(), board.Score());
-  printf("Time: %.1fms\n", (stop-start)/CPMS);
+  printf("Time: %.1fms  (%.2fms/move)\n", (stop-start)/CPMS,
+    (stop-start)/CPMS/std::max(nMoves, 1));
+}
+
+// Same as PlayGame, for the other board sizes.
+template<class BoardType>
+void PlayGameT(SearchPlayerT<BoardType>& player)
+{
+  RNG rng(1234);
+
+  BoardType::Init();
+  player.NewGame();
+  BoardType board;
+  board.AddRandomTile(rng);
+  board.AddRandomTile(rng);
+
+  clock_t start = clock();
+  int nMoves = 0;
+  while (true) {
+    Direction move = player.FindBestMove(board);
+    if (move == None) break;
+    board.Slide(move);
+    ++nMoves;
+    board.Print();
+    printf("Score: %lld, %lld  (%d)\n", 1LL << board.MaxTile(), board.score, nMoves);
+    board.AddRandomTile(rng);
+    if (board.IsDead()) break;
+  }
+  clock_t stop = clock();
+  printf("Final Board (%d moves):\n", nMoves);
+  board.Print();
+  printf("%lld  %lld\n", 1LL << board.MaxTile(), board.score);
+  printf("Time: %.1fms  (%.2fms/move)\n", (stop-start)/CPMS,
+    (stop-start)/CPMS/std::max(nMoves, 1));
+}
+
+// Plays numGames games at once on a SearchScheduler; each game submits its
+// next search from the callback of the last one.
+void PlayInterleaved(int numGames, int numThreads, double msPerMove)
+{
+  struct Game
+  {
+    Game(unsigned int seed) : rng(seed), nMoves(0) { board = NewGame(rng); }
+    Board board;
+    RNG rng;
+    int nMoves;
+  };
+  std::vector<std::unique_ptr<Game> > games;
+  for(int i=0; i<numGames; ++i) games.push_back(std::unique_ptr<Game>(new Game(i + 1)));
+
+  SearchScheduler scheduler(numThreads);
+  std::function<void(Game*)> next = [&](Game* g) {
+    scheduler.Submit(g->board, 0, msPerMove, [&next, g](Direction move) {
+      if (move == None) return;
+      g->board.Slide(move);
+      ++g->nMoves;
+      g->board.AddRandomTile(g->rng);
+      if (!g->board.IsDead()) next(g);
+    });
+  };
+
+  const SearchClock::time_point start = SearchClock::now();
+  for(int i=0; i<numGames; ++i) next(games[i].get());
+  scheduler.WaitIdle();
+  const double ms = std::chrono::duration<double, std::milli>(SearchClock::now() - start).count();
+
+  long long nMoves = 0;
+  double sumScore = 0.0;
+  for(int i=0; i<numGames; ++i){
+    nMoves += games[i]->nMoves;
+    sumScore += games[i]->board.Score();
+  }
+  printf("%d games on %d threads: mean score %.0f, %lld moves in %.1fs (%.2fms/move)\n",
+    numGames, scheduler.NumThreads(), sumScore / std::max(numGames, 1), nMoves,
+    ms / 1000.0, ms / std::max(nMoves, 1LL));
+}
+
+Player* MakePlayer(const char* name)
+{
+  if (strcmp(name, "mcts") == 0) return new MctsPlayer();
+  if (strcmp(name, "random") == 0) return new RandomPlayer();
+  return new SearchPlayer();
 }
 
 int main(int argc, char* argv[])
 {
   Board::Init();
 
+  // Usage: Game2048 [--pages=normal|transparent|explicit] <mode and arguments>
+  // Huge pages for the search tree and dedup tables, where the OS grants them.
+  if (argc > 1 && strncmp(argv[1], "--pages=", 8) == 0) {
+    PageMode mode;
+    if (!ParsePageMode(argv[1] + 8, &mode)) {
+      printf("Unknown page mode %s\n", argv[1] + 8);
+      return EXIT_FAILURE;
+    }
+    SetPageMode(mode);
+    --argc;
+    ++argv;
+  }
+
   RunUnitTests();
-  TimeMoveSpeed();
-  std::unique_ptr<Player> player(new SearchPlayer());
+
+  // Usage: Game2048 batch <results file> <games> [search|mcts|random] [first seed] [records file]
+  // Rerunning with the same results file picks up where the last run stopped.
+  if (argc > 3 && strcmp(argv[1], "batch") == 0) {
+    std::unique_ptr<Player> player(MakePlayer(argc > 4 ? argv[4] : "search"));
+    BatchRunner runner(argv[2]);
+    if (argc > 6) runner.recordsPath = argv[6];
+    const unsigned int firstSeed = (argc > 5 ? (unsigned int)strtoul(argv[5], NULL, 10) : 1);
+    return runner.Run(player.get(), firstSeed, atoi(argv[3])) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  // Usage: Game2048 coordinator [--listen-any] <results file> <games> <port> [first seed] [seeds per range]
+  // then on any number of processes: Game2048 worker <port> [player] [host]
+  // The coordinator accepts workers on this machine only, unless given
+  // --listen-any.  The protocol is unauthenticated and unencrypted (see
+  // BatchCoordinator), so only listen on any interface on a trusted network.
+  bool bListenAny = false;
+  if (argc > 2 && strcmp(argv[1], "coordinator") == 0 && strcmp(argv[2], "--listen-any") == 0) {
+    bListenAny = true;
+    argv[2] = argv[1]; // drop the option, keeping the mode in argv[1]
+    --argc;
+    ++argv;
+  }
+  if (argc > 4 && strcmp(argv[1], "coordinator") == 0) {
+    BatchCoordinator coordinator(argv[2]);
+    coordinator.bLocalOnly = !bListenAny;
+    const unsigned int firstSeed = (argc > 5 ? (unsigned int)strtoul(argv[5], NULL, 10) : 1);
+    if (argc > 6) coordinator.chunkSize = std::max(1, atoi(argv[6]));
+    return coordinator.Run(atoi(argv[4]), firstSeed, atoi(argv[3])) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  if (argc > 2 && strcmp(argv[1], "worker") == 0) {
+    std::unique_ptr<Player> player(MakePlayer(argc > 3 ? argv[3] : "search"));
+    BatchWorker worker(player.get());
+    return worker.Run(argc > 4 ? argv[4] : "127.0.0.1", atoi(argv[2])) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  // Usage: Game2048 interleave <games> [threads] [ms per move]
+  if (argc > 2 && strcmp(argv[1], "interleave") == 0) {
+    PlayInterleaved(atoi(argv[2]), argc > 3 ? atoi(argv[3]) : 0, argc > 4 ? atof(argv[4]) : 10.0);
+    return EXIT_SUCCESS;
+  }
+
+  // Usage: Game2048 book <book file> [positions] [search ms]
+  if (argc > 2 && strcmp(argv[1], "book") == 0) {
+    BookBuilder builder;
+    if (argc > 3) builder.maxPositions = (size_t)atol(argv[3]);
+    if (argc > 4) builder.searchMS = atof(argv[4]);
+    OpeningBook book;
+    builder.Build(&book);
+    printf("Book: %lu entries\n", (unsigned long)book.Size());
+    return book.Save(argv[2]) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  // Usage: Game2048 makesuite <suite file> [positions] [reference ms]
+  if (argc > 2 && strcmp(argv[1], "makesuite") == 0) {
+    SuiteBuilder builder;
+    if (argc > 3) builder.numPositions = (size_t)atol(argv[3]);
+    if (argc > 4) builder.referenceMS = atof(argv[4]);
+    PositionSuite suite;
+    builder.Build(&suite);
+    printf("Suite: %lu positions\n", (unsigned long)suite.positions.size());
+    return suite.Save(argv[2]) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  // Usage: Game2048 suite <suite file> [ms per position] [max depth] [threads]
+  // With a max depth the decisions don't depend on speed.
+  if (argc > 2 && strcmp(argv[1], "suite") == 0) {
+    PositionSuite suite;
+    if (!suite.Load(argv[2])) {
+      printf("Can't load %s\n", argv[2]);
+      return EXIT_FAILURE;
+    }
+    SuiteRunner runner;
+    if (argc > 3) runner.msPerPosition = atof(argv[3]);
+    if (argc > 4) runner.maxDepth = atoi(argv[4]);
+    if (argc > 5) runner.numThreads = atoi(argv[5]);
+    SuiteReport report;
+    runner.Run(suite, &report);
+    report.Print();
+    return EXIT_SUCCESS;
+  }
+
+  // Usage: Game2048 analyze <records file> [ms per position] [threads] [output file]
+  if (argc > 2 && strcmp(argv[1], "analyze") == 0) {
+    FILE* in = fopen(argv[2], "r");
+    if (in == NULL) {
+      printf("Can't open %s\n", argv[2]);
+      return EXIT_FAILURE;
+    }
+    FILE* out = (argc > 5 ? fopen(argv[5], "w") : stdout);
+    if (out == NULL) {
+      fclose(in);
+      printf("Can't write %s\n", argv[5]);
+      return EXIT_FAILURE;
+    }
+    GameAnalyzer analyzer;
+    if (argc > 3) analyzer.msPerPosition = atof(argv[3]);
+    if (argc > 4) analyzer.numThreads = atoi(argv[4]);
+    analyzer.Run(in, out);
+    fclose(in);
+    if (out != stdout) fclose(out);
+    analyzer.stats.Print();
+    return EXIT_SUCCESS;
+  }
+
+  RunBenchmarks();
+  // Usage: Game2048 [search|mcts|random|3x3|5x5|bigtiles] [book file]
+  const char* name = (argc > 1 ? argv[1] : "search");
+  if (strcmp(name, "3x3") == 0) {
+    SearchPlayerT<Board3x3> p;
+    PlayGameT(p);
+    return EXIT_SUCCESS;
+  }
+  if (strcmp(name, "5x5") == 0) {
+    SearchPlayerT<Board5x5> p;
+    PlayGameT(p);
+    return EXIT_SUCCESS;
+  }
+  if (strcmp(name, "bigtiles") == 0) {
+    SearchPlayerT<BigTileBoard> p;
+    PlayGameT(p);
+    return EXIT_SUCCESS;
+  }
+  std::unique_ptr<Player> player(MakePlayer(name));
+  OpeningBook book;
+  if (argc > 2 && strcmp(name, "search") == 0 && book.Load(argv[2]))
+    static_cast<SearchPlayer*>(player.get())->book = &book;
   PlayGame(player.get());
+  TRACE_WRITE("trace.json");
 
   printf("Press any key to continue...");
   getchar();
@@ -0,0 +1,185 @@
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#include <limits>
+#include "batch_eval.h"
+
+// Corner weights for each of the eight board symmetries, indexed by cell of
+// the untransformed board, so the max over symmetries needs no shuffling.
+struct SymWeightTable
+{
+	SymWeightTable()
+	{
+		Board b;
+		for(int i=0; i<16; ++i) b.SetCell(i, i);
+		for(int s=0; s<8; ++s){
+			Board t = b;
+			for(int r=0; r<(s>>1); ++r) t.RotateCW();
+			if (s & 1) t.ReflectHorz();
+			for(int i=0; i<16; ++i)
+				w[s][RowVal(t.board[i>>2], i&3)] = (float)Board::CornerWeight(i);
+		}
+	}
+
+	__declspec( align(16) ) float w[8][16];
+};
+
+static const SymWeightTable& SymWeights()
+{
+	static const SymWeightTable table;
+	return table;
+}
+
+// Unpacks the 16 nibbles of a board into 16 bytes, cell i in byte i.
+static inline __m128i Cells(uint64_t b)
+{
+	const __m128i mask = _mm_set1_epi8(0x0F);
+	__m128i x = _mm_loadl_epi64((const __m128i*)&b);
+	__m128i lo = _mm_and_si128(x, mask);
+	__m128i hi = _mm_and_si128(_mm_srli_epi64(x, 4), mask);
+	return _mm_unpacklo_epi8(lo, hi);
+}
+
+static inline __m128i AbsDiff(__m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+}
+
+static inline int PopCount16(int m)
+{
+	m = m - ((m >> 1) & 0x5555);
+	m = (m & 0x3333) + ((m >> 2) & 0x3333);
+	m = (m + (m >> 4)) & 0x0F0F;
+	return (m + (m >> 8)) & 0x1F;
+}
+
+// Per-board heuristic terms, computed with the cells in one register.
+static inline void Terms(uint64_t board, float* maxTile, float* nEmpty, float* smooth,
+	float* corner, byte* dead)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i horzMask = _mm_set_epi8(0,-1,-1,-1, 0,-1,-1,-1, 0,-1,-1,-1, 0,-1,-1,-1);
+	const __m128i vertMask = _mm_set_epi8(0,0,0,0, -1,-1,-1,-1, -1,-1,-1,-1, -1,-1,-1,-1);
+
+	const __m128i v = Cells(board);
+	const __m128i isZero = _mm_cmpeq_epi8(v, zero);
+	const int emptyBits = _mm_movemask_epi8(isZero);
+	*nEmpty = (float)PopCount16(emptyBits);
+
+	__m128i m = _mm_max_epu8(v, _mm_srli_si128(v, 8));
+	m = _mm_max_epu8(m, _mm_srli_si128(m, 4));
+	m = _mm_max_epu8(m, _mm_srli_si128(m, 2));
+	m = _mm_max_epu8(m, _mm_srli_si128(m, 1));
+	*maxTile = (float)(_mm_cvtsi128_si32(m) & 0xFF);
+
+	// Neighbor to the right (same row) and below, counted only if both cells
+	// hold a tile.
+	const __m128i h = _mm_srli_si128(v, 1);
+	const __m128i d = _mm_srli_si128(v, 4);
+	const __m128i hOk = _mm_andnot_si128(_mm_or_si128(isZero, _mm_srli_si128(isZero, 1)), horzMask);
+	const __m128i dOk = _mm_andnot_si128(_mm_or_si128(isZero, _mm_srli_si128(isZero, 4)), vertMask);
+	const __m128i diffs = _mm_add_epi8(_mm_and_si128(AbsDiff(v, h), hOk),
+		_mm_and_si128(AbsDiff(v, d), dOk));
+	const __m128i sad = _mm_sad_epu8(diffs, zero);
+	*smooth = (float)(_mm_cvtsi128_si32(sad) + _mm_cvtsi128_si32(_mm_srli_si128(sad, 8)));
+
+	if (dead != nullptr) {
+		const __m128i same = _mm_or_si128(_mm_and_si128(_mm_cmpeq_epi8(v, h), horzMask),
+			_mm_and_si128(_mm_cmpeq_epi8(v, d), vertMask));
+		*dead = (emptyBits == 0 && _mm_movemask_epi8(same) == 0);
+	}
+
+	// 2^v for each cell, built directly in the float exponent.
+	const __m128i bias = _mm_set1_epi32(127);
+	const __m128i lo = _mm_unpacklo_epi8(v, zero);
+	const __m128i hi = _mm_unpackhi_epi8(v, zero);
+	__m128 p[4];
+	p[0] = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_unpacklo_epi16(lo, zero), bias), 23));
+	p[1] = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_unpackhi_epi16(lo, zero), bias), 23));
+	p[2] = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_unpacklo_epi16(hi, zero), bias), 23));
+	p[3] = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_unpackhi_epi16(hi, zero), bias), 23));
+
+	const SymWeightTable& table = SymWeights();
+	__m128 acc[8];
+	for(int s=0; s<8; ++s){
+		const float* w = table.w[s];
+		acc[s] = _mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(p[0], _mm_load_ps(w)), _mm_mul_ps(p[1], _mm_load_ps(w + 4))),
+			_mm_add_ps(_mm_mul_ps(p[2], _mm_load_ps(w + 8)), _mm_mul_ps(p[3], _mm_load_ps(w + 12))));
+	}
+	_MM_TRANSPOSE4_PS(acc[0], acc[1], acc[2], acc[3]);
+	_MM_TRANSPOSE4_PS(acc[4], acc[5], acc[6], acc[7]);
+	__m128 best = _mm_max_ps(
+		_mm_add_ps(_mm_add_ps(acc[0], acc[1]), _mm_add_ps(acc[2], acc[3])),
+		_mm_add_ps(_mm_add_ps(acc[4], acc[5]), _mm_add_ps(acc[6], acc[7])));
+	best = _mm_max_ps(best, _mm_movehl_ps(best, best));
+	best = _mm_max_ss(best, _mm_shuffle_ps(best, best, 1));
+	*corner = _mm_cvtss_f32(best);
+}
+
+// ln(x) = e*ln(2) + ln(m) with m in [sqrt(1/2), sqrt(2)), and
+// ln(m) = 2*atanh(t) for t = (m-1)/(m+1), so |t| < 0.172 and four odd terms
+// of the series are plenty.
+static inline __m128 Log(__m128 x)
+{
+	const __m128i xi = _mm_castps_si128(x);
+	__m128i e = _mm_sub_epi32(_mm_srli_epi32(xi, 23), _mm_set1_epi32(127));
+	__m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(xi, _mm_set1_epi32(0x007FFFFF)),
+		_mm_set1_epi32(0x3F800000)));
+	const __m128 big = _mm_cmpgt_ps(m, _mm_set1_ps(1.41421356f));
+	m = _mm_sub_ps(m, _mm_and_ps(big, _mm_mul_ps(m, _mm_set1_ps(0.5f))));
+	e = _mm_sub_epi32(e, _mm_castps_si128(big)); // big is all ones, i.e. -1
+
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 t = _mm_div_ps(_mm_sub_ps(m, one), _mm_add_ps(m, one));
+	const __m128 t2 = _mm_mul_ps(t, t);
+	__m128 poly = _mm_add_ps(_mm_set1_ps(1.0f / 5.0f), _mm_mul_ps(t2, _mm_set1_ps(1.0f / 7.0f)));
+	poly = _mm_add_ps(_mm_set1_ps(1.0f / 3.0f), _mm_mul_ps(t2, poly));
+	poly = _mm_add_ps(one, _mm_mul_ps(t2, poly));
+	const __m128 lnm = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(2.0f), t), poly);
+	__m128 r = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(e), _mm_set1_ps(0.69314718f)), lnm);
+
+	// log(0) is -inf, as in the scalar code.
+	const __m128 isZero = _mm_cmpeq_ps(x, _mm_setzero_ps());
+	const __m128 negInf = _mm_set1_ps(-std::numeric_limits<float>::infinity());
+	return _mm_or_ps(_mm_andnot_ps(isZero, r), _mm_and_ps(isZero, negInf));
+}
+
+void BatchEval::Log4(const float* in, float* out)
+{
+	_mm_storeu_ps(out, Log(_mm_loadu_ps(in)));
+}
+
+void BatchEval::Eval(const uint64_t* boards, const int* gameScores, size_t n,
+	float* out, byte* dead)
+{
+	__declspec( align(16) ) float score[4], maxTile[4], nEmpty[4], smooth[4], corner[4], result[4];
+	byte deadTmp[4];
+	for(size_t i=0; i<n; i+=4){
+		const int m = (int)std::min((size_t)4, n - i);
+		for(int j=0; j<4; ++j){
+			if (j < m) {
+				score[j] = (gameScores != nullptr ? (float)gameScores[i+j] : 1.0f);
+				Terms(boards[i+j], &maxTile[j], &nEmpty[j], &smooth[j], &corner[j],
+					dead != nullptr ? &deadTmp[j] : nullptr);
+			} else {
+				score[j] = 1.0f;
+				maxTile[j] = nEmpty[j] = smooth[j] = corner[j] = 0.0f;
+			}
+		}
+
+		const __m128 a = Log(_mm_load_ps(score));
+		const __m128 e = Log(_mm_add_ps(_mm_mul_ps(_mm_load_ps(corner), _mm_set1_ps(0.1f)),
+			_mm_set1_ps(1.0f)));
+		__m128 r = _mm_mul_ps(_mm_set1_ps(0.2f), a);
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(0.3f), _mm_load_ps(maxTile)));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(0.3f), _mm_load_ps(nEmpty)));
+		r = _mm_sub_ps(r, _mm_mul_ps(_mm_set1_ps(0.3f), _mm_load_ps(smooth)));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(0.5f), e));
+		_mm_store_ps(result, r);
+
+		for(int j=0; j<m; ++j){
+			out[i+j] = result[j];
+			if (dead != nullptr) dead[i+j] = deadTmp[j];
+		}
+	}
+}
@@ -0,0 +1,345 @@
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include "batch_runner.h"
+#include "rng.h"
+
+typedef std::chrono::steady_clock Clock;
+
+////////////////////////////////////////////////////////////
+// GameResult
+
+std::string GameResult::Format() const
+{
+	char line[128];
+	snprintf(line, sizeof(line), "%u %d %d %d %.1f", seed, score, maxTile, moves, ms);
+	return line;
+}
+
+bool GameResult::Parse(const char* line, GameResult* r)
+{
+	int len = 0;
+	return sscanf(line, "%u %d %d %d %lf%n", &r->seed, &r->score, &r->maxTile, &r->moves, &r->ms, &len) == 5
+		&& (line[len] == '\n' || line[len] == '\r' || line[len] == '\0');
+}
+
+////////////////////////////////////////////////////////////
+// GameRecord
+
+const char GameRecord::MoveChars[NumDirections + 1] = "LRUD";
+
+std::string GameRecord::Format() const
+{
+	char prefix[16];
+	snprintf(prefix, sizeof(prefix), "%u ", seed);
+	return prefix + moves;
+}
+
+bool GameRecord::Parse(const char* line, GameRecord* r)
+{
+	int len = 0;
+	if (sscanf(line, "%u %n", &r->seed, &len) != 1 || len == 0 || line[len-1] != ' ') return false;
+	line += len;
+	len = (int)strspn(line, MoveChars);
+	if (line[len] != '\n' && line[len] != '\r' && line[len] != '\0') return false;
+	r->moves.assign(line, len);
+	return true;
+}
+
+////////////////////////////////////////////////////////////
+// BatchStats
+
+void BatchStats::Reset()
+{
+	nGames = 0;
+	sumScore = sumScoreSq = 0.0;
+	minScore = INT_MAX;
+	maxScore = 0;
+	moves = 0;
+	ms = 0.0;
+	memset(tileCounts, 0, sizeof(tileCounts));
+}
+
+void BatchStats::Add(const GameResult& r)
+{
+	++nGames;
+	sumScore += r.score;
+	sumScoreSq += (double)r.score * r.score;
+	minScore = std::min(minScore, r.score);
+	maxScore = std::max(maxScore, r.score);
+	moves += r.moves;
+	ms += r.ms;
+	++tileCounts[std::max(0, std::min(r.maxTile, 15))];
+}
+
+void BatchStats::Print() const
+{
+	if (nGames == 0) {
+		printf("Games: 0\n");
+		return;
+	}
+	const double mean = sumScore / nGames;
+	const double var = std::max(0.0, sumScoreSq / nGames - mean * mean);
+	printf("Games: %lld  score: %.0f +- %.0f  (min %d, max %d)  %.2fms/move\n",
+		nGames, mean, sqrt(var), minScore, maxScore, ms / std::max(moves, 1LL));
+
+	// Fraction of games that reached each tile from 512 up.
+	long long atLeast = 0;
+	for(int i=15; i>=9; --i){
+		atLeast += tileCounts[i];
+		if (atLeast > 0) printf("  %5d: %5.1f%%", 1 << i, 100.0 * atLeast / nGames);
+	}
+	printf("\n");
+}
+
+////////////////////////////////////////////////////////////
+// SeedRanges
+
+void SeedRanges::Add(unsigned int seed)
+{
+	AddRange(seed, seed + 1);
+}
+
+void SeedRanges::AddRange(unsigned int begin, unsigned int end)
+{
+	if (begin >= end) return;
+	typedef std::vector<std::pair<unsigned int, unsigned int> >::iterator Iter;
+	Iter it = std::lower_bound(ranges.begin(), ranges.end(), std::make_pair(begin, 0u));
+	if (it != ranges.begin() && (it-1)->second >= begin) --it;
+
+	// Swallow every range that overlaps or touches [begin, end).
+	Iter first = it;
+	while(it != ranges.end() && it->first <= end){
+		begin = std::min(begin, it->first);
+		end = std::max(end, it->second);
+		++it;
+	}
+	it = ranges.erase(first, it);
+	ranges.insert(it, std::make_pair(begin, end));
+}
+
+bool SeedRanges::Contains(unsigned int seed) const
+{
+	std::vector<std::pair<unsigned int, unsigned int> >::const_iterator it =
+		std::upper_bound(ranges.begin(), ranges.end(), std::make_pair(seed, UINT_MAX));
+	return it != ranges.begin() && seed < (it-1)->second;
+}
+
+long long SeedRanges::Count() const
+{
+	long long n = 0;
+	for(size_t i=0; i<ranges.size(); ++i)
+		n += ranges[i].second - ranges[i].first;
+	return n;
+}
+
+////////////////////////////////////////////////////////////
+// BatchRunner
+
+BatchRunner::BatchRunner(const std::string& resultsPath_)
+	: checkpointEvery(100), resultsPath(resultsPath_), checkpointPath(resultsPath_ + ".ckpt"),
+	  results(NULL), records(NULL), sinceCheckpoint(0)
+{
+}
+
+GameResult BatchRunner::PlayGame(Player* player, unsigned int seed, std::string* moves)
+{
+	if (moves != NULL) moves->clear();
+	RNG rng(seed);
+	Board board;
+	board.AddRandomTile(rng);
+	board.AddRandomTile(rng);
+
+	player->NewGame();
+	const Clock::time_point start = Clock::now();
+	int nMoves = 0;
+	while(true){
+		const Direction move = player->FindBestMove(board);
+		if (move == None) break;
+		board.Slide(move);
+		++nMoves;
+		if (moves != NULL) moves->push_back(GameRecord::MoveChars[move]);
+		board.AddRandomTile(rng);
+		if (board.IsDead()) break;
+	}
+
+	GameResult r;
+	r.seed = seed;
+	r.score = board.Score();
+	r.maxTile = board.MaxTile();
+	r.moves = nMoves;
+	r.ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	return r;
+}
+
+bool BatchRunner::Run(Player* player, unsigned int firstSeed, int numGames)
+{
+	if (!Open()) return false;
+	for(int i=0; i<numGames; ++i){
+		const unsigned int seed = firstSeed + i;
+		if (done.Contains(seed)) continue;
+		GameRecord record;
+		record.seed = seed;
+		const GameResult r = PlayGame(player, seed, records != NULL ? &record.moves : NULL);
+		if (records != NULL) {
+			// Before the result, so a game counted as done is always recorded.
+			fprintf(records, "%s\n", record.Format().c_str());
+			fflush(records);
+		}
+		Record(r);
+	}
+	Close();
+	return true;
+}
+
+// A line cut short by a crash is left in place but marked bad and ended,
+// so it can't run into the next one or parse as a shorter line.
+static FILE* OpenForAppend(const std::string& path)
+{
+	FILE* f = fopen(path.c_str(), "ab");
+	if (f == NULL) return NULL;
+	fseek(f, 0, SEEK_END);
+	if (ftell(f) > 0) {
+		FILE* in = fopen(path.c_str(), "rb");
+		if (in != NULL) {
+			fseek(in, -1, SEEK_END);
+			if (fgetc(in) != '\n') fputs("!\n", f);
+			fclose(in);
+		}
+	}
+	return f;
+}
+
+bool BatchRunner::Open()
+{
+	Resume();
+	printf("Resuming with %lld games done\n", done.Count());
+
+	results = OpenForAppend(resultsPath);
+	if (results == NULL) return false;
+	if (!recordsPath.empty()) {
+		records = OpenForAppend(recordsPath);
+		if (records == NULL) {
+			fclose(results);
+			results = NULL;
+			return false;
+		}
+	}
+	sinceCheckpoint = 0;
+	return true;
+}
+
+void BatchRunner::Record(const GameResult& r)
+{
+	if (done.Contains(r.seed)) return;
+	fprintf(results, "%s\n", r.Format().c_str());
+	fflush(results);
+	stats.Add(r);
+	done.Add(r.seed);
+
+	if (++sinceCheckpoint >= checkpointEvery) {
+		SaveCheckpoint(ftell(results));
+		stats.Print();
+		sinceCheckpoint = 0;
+	}
+}
+
+void BatchRunner::Close()
+{
+	if (results == NULL) return;
+	SaveCheckpoint(ftell(results));
+	fclose(results);
+	results = NULL;
+	if (records != NULL) fclose(records);
+	records = NULL;
+	stats.Print();
+}
+
+// Rebuilds stats and done from the checkpoint plus the results after it.
+void BatchRunner::Resume()
+{
+	long long offset = 0;
+	if (!LoadCheckpoint(&offset)) {
+		stats.Reset();
+		done.Clear();
+		offset = 0;
+	}
+	ReadResults(offset);
+}
+
+// Folds the results file from the given offset into stats and done.
+// Only complete, well-formed lines count.
+void BatchRunner::ReadResults(long long offset)
+{
+	FILE* f = fopen(resultsPath.c_str(), "rb");
+	if (f == NULL) return;
+	fseek(f, 0, SEEK_END);
+	if (ftell(f) < offset) {
+		// The results file is not the one the checkpoint was written for.
+		stats.Reset();
+		done.Clear();
+		offset = 0;
+	}
+	fseek(f, (long)offset, SEEK_SET);
+
+	char line[256];
+	while(fgets(line, sizeof(line), f) != NULL){
+		if (strchr(line, '\n') == NULL) break;
+		GameResult r;
+		if (!GameResult::Parse(line, &r) || done.Contains(r.seed)) continue;
+		stats.Add(r);
+		done.Add(r.seed);
+	}
+	fclose(f);
+}
+
+bool BatchRunner::LoadCheckpoint(long long* offset)
+{
+	FILE* f = fopen(checkpointPath.c_str(), "r");
+	if (f == NULL) return false;
+
+	stats.Reset();
+	done.Clear();
+	int version = 0;
+	long long nRanges = 0;
+	bool bOK = fscanf(f, "2048-batch-checkpoint %d\n", &version) == 1 && version == 1
+		&& fscanf(f, "offset %lld\n", offset) == 1
+		&& fscanf(f, "games %lld %lf %lf %d %d %lld %lf\n", &stats.nGames, &stats.sumScore,
+			&stats.sumScoreSq, &stats.minScore, &stats.maxScore, &stats.moves, &stats.ms) == 7
+		&& fscanf(f, "tiles") == 0;
+	for(int i=0; bOK && i<16; ++i)
+		bOK = fscanf(f, "%lld", &stats.tileCounts[i]) == 1;
+	bOK = bOK && fscanf(f, " ranges %lld", &nRanges) == 1;
+	for(long long i=0; bOK && i<nRanges; ++i){
+		unsigned int begin, end;
+		bOK = fscanf(f, "%u %u", &begin, &end) == 2;
+		if (bOK) done.AddRange(begin, end);
+	}
+	fclose(f);
+	return bOK;
+}
+
+// Written to a temporary file first so a crash never leaves a torn
+// checkpoint; at worst there is none and Resume rereads the whole results
+// file.
+void BatchRunner::SaveCheckpoint(long long offset) const
+{
+	const std::string tmpPath = checkpointPath + ".tmp";
+	FILE* f = fopen(tmpPath.c_str(), "w");
+	if (f == NULL) return;
+	fprintf(f, "2048-batch-checkpoint 1\n");
+	fprintf(f, "offset %lld\n", offset);
+	fprintf(f, "games %lld %.17g %.17g %d %d %lld %.17g\n", stats.nGames, stats.sumScore,
+		stats.sumScoreSq, stats.minScore, stats.maxScore, stats.moves, stats.ms);
+	fprintf(f, "tiles");
+	for(int i=0; i<16; ++i) fprintf(f, " %lld", stats.tileCounts[i]);
+	fprintf(f, "\nranges %lu\n", (unsigned long)done.ranges.size());
+	for(size_t i=0; i<done.ranges.size(); ++i)
+		fprintf(f, "%u %u\n", done.ranges[i].first, done.ranges[i].second);
+	fclose(f);
+
+	remove(checkpointPath.c_str());
+	rename(tmpPath.c_str(), checkpointPath.c_str());
+}
@@ -0,0 +1,118 @@
+#ifndef __BATCH_RUNNER_H__
+#define __BATCH_RUNNER_H__
+
+#include <stdio.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include "player.h"
+
+// Outcome of one game; a line of the results file.
+struct GameResult
+{
+	unsigned int seed;
+	int score;
+	int maxTile; // log2
+	int moves;
+	double ms;   // wall time
+
+	// The line format "seed score maxTile moves ms", without the newline.
+	// Parse accepts only a whole line.
+	std::string Format() const;
+	static bool Parse(const char* line, GameResult* r);
+};
+
+// The moves of one game, enough to replay it: the seed gives the tiles.
+struct GameRecord
+{
+	unsigned int seed;
+	std::string moves; // one of MoveChars per move
+
+	// The line format "seed moves", without the newline.  Parse accepts only
+	// a whole line.
+	std::string Format() const;
+	static bool Parse(const char* line, GameRecord* r);
+
+	static const char MoveChars[NumDirections + 1]; // "LRUD"
+};
+
+// Statistics over any number of games, updated one game at a time.
+struct BatchStats
+{
+	BatchStats() { Reset(); }
+	void Reset();
+	void Add(const GameResult& r);
+	void Print() const;
+
+	long long nGames;
+	double sumScore;
+	double sumScoreSq;
+	int minScore;
+	int maxScore;
+	long long moves;
+	double ms;
+	long long tileCounts[16]; // games whose largest tile is 2^i
+};
+
+// Set of seeds as sorted, disjoint, non-adjacent [begin, end) ranges.
+class SeedRanges
+{
+public:
+	void Clear() { ranges.clear(); }
+	void Add(unsigned int seed);
+	void AddRange(unsigned int begin, unsigned int end);
+	bool Contains(unsigned int seed) const;
+	long long Count() const;
+
+	std::vector<std::pair<unsigned int, unsigned int> > ranges;
+};
+
+// Plays games with seeds [firstSeed, firstSeed + numGames) and appends each
+// result to a results file as soon as the game ends.  Every
+// checkpointEvery games it writes <results>.ckpt with the finished seed
+// ranges, the statistics so far and how much of the results file they
+// cover.  A rerun with the same results file resumes: it loads the
+// checkpoint, folds in the results written after it, and plays only the
+// seeds not yet finished.  The results file is the record; without a
+// checkpoint everything is rebuilt from it, and a line cut short by a
+// crash is ignored (its game is replayed).  With recordsPath set, the
+// moves of each game played are also appended there as a GameRecord; a game
+// replayed after a crash may be recorded twice.
+class BatchRunner
+{
+public:
+	BatchRunner(const std::string& resultsPath);
+
+	// Returns false if the results file can't be written.
+	bool Run(Player* player, unsigned int firstSeed, int numGames);
+
+	// Fills in *moves, if given, with the moves played.
+	static GameResult PlayGame(Player* player, unsigned int seed, std::string* moves = NULL);
+
+	// The pieces of Run, for callers that get results from elsewhere:
+	// Open resumes and opens the results file, Record appends one result
+	// (skipping seeds already done) and checkpoints when due, and Close
+	// writes a final checkpoint.
+	bool Open();
+	void Record(const GameResult& r);
+	void Close();
+
+	int checkpointEvery;
+	std::string recordsPath; // empty = no records
+	BatchStats stats;
+	SeedRanges done;
+
+private:
+	void Resume();
+	void ReadResults(long long offset);
+	bool LoadCheckpoint(long long* offset);
+	void SaveCheckpoint(long long offset) const;
+
+	std::string resultsPath;
+	std::string checkpointPath;
+	FILE* results;
+	FILE* records;
+	int sinceCheckpoint;
+};
+
+#endif
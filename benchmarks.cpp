@@ -0,0 +1,537 @@
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include "batch_eval.h"
+#include "benchmarks.h"
+#include "board.h"
+#include "large_pages.h"
+#include "node_table.h"
+#include "playout_engine.h"
+#include "random_player.h"
+#include "rng.h"
+#include "search_player.h"
+#include "search_tree.h"
+#include "thread_pool.h"
+
+static const double CPMS = CLOCKS_PER_SEC / 1000.0;
+
+static void TimeMoveSpeed()
+{
+  Board b;
+  b.SetRow(0, 0,1,1,0);
+  b.SetRow(1, 2,2,0,0);
+  b.SetRow(2, 1,0,0,1);
+  b.SetRow(3, 0,0,0,3);  
+
+  clock_t start = clock();
+  const int NumIters = 1000000;
+  int score = 0;
+  for (int i = 0; i < NumIters; ++i) {    
+    Board c;
+    c = b; c.Slide(Up); score += c.score;
+    c = b; c.Slide(Right); score += c.score;
+    c = b; c.Slide(Down); score += c.score;
+    c = b; c.Slide(Left); score += c.score;
+  }
+  clock_t stop = clock();
+  printf("Score: %d\n", score);
+  printf("Iterations: %d\n", NumIters);
+  printf("Time: %0.1fms\n", (stop-start)/CPMS);
+
+  start = clock();
+  score = 0;
+  for (int i = 0; i < NumIters; ++i) {
+    Board succ[NumDirections];
+    b.GenerateMoves(succ);
+    score += succ[Up].score + succ[Right].score + succ[Down].score + succ[Left].score;
+  }
+  stop = clock();
+  printf("GenerateMoves score: %d  time: %0.1fms\n", score, (stop-start)/CPMS);
+}
+
+// Random playouts one game at a time vs. the lockstep engine.
+static void TimePlayouts()
+{
+  const int NumGames = 4096;
+  RNG rng(42);
+  std::vector<uint64_t> starts(NumGames);
+  std::vector<int> startScores(NumGames, 0);
+  for(int i=0; i<NumGames; ++i){
+    Board b;
+    b.AddRandomTile(rng);
+    b.AddRandomTile(rng);
+    starts[i] = b.Bits();
+  }
+
+  RandomPlayer player;
+  clock_t start = clock();
+  long long moves = 0;
+  for(int i=0; i<NumGames; ++i){
+    Board b;
+    b.SetBits(starts[i]);
+    Direction dir;
+    while((dir = player.FindBestMove(b)) != None){
+      b.Slide(dir);
+      b.AddRandomTile(rng);
+      ++moves;
+    }
+  }
+  double ms = (clock() - start) / CPMS;
+  printf("Serial playouts: %d games, %lld moves, %.1fms (%.0f playouts/s)\n",
+    NumGames, moves, ms, NumGames * 1000.0 / ms);
+
+  PlayoutEngine engine(NumGames);
+  std::vector<int> scores(NumGames), depths(NumGames);
+  start = clock();
+  engine.Run(&starts[0], &startScores[0], NumGames, 42, &scores[0], &depths[0]);
+  ms = (clock() - start) / CPMS;
+  moves = 0;
+  for(int i=0; i<NumGames; ++i) moves += depths[i];
+  printf("Lockstep playouts: %d games, %lld moves, %.1fms (%.0f playouts/s)\n",
+    NumGames, moves, ms, NumGames * 1000.0 / ms);
+}
+
+// Expansion and backup time on a multi-million-node tree, serial vs. the
+// full pool.
+static void TimeBackup()
+{
+  Board b;
+  b.SetRow(0, 1,2,3,0);
+  b.SetRow(1, 0,1,5,2);
+  b.SetRow(2, 4,0,0,1);
+  b.SetRow(3, 2,0,0,0);
+  b.score = 300;
+
+  const int NumThreads[2] = { 1, 0 };
+  for(int i=0; i<2; ++i){
+    ThreadPool pool(NumThreads[i]);
+    SearchPlayer player(&pool);
+    player.timeManager.baseMS = 1e9;
+    player.maxMoveDepth = 5;
+    player.FindBestMove(b);
+    printf("Expand: %d threads, %lu nodes, %.1fms\n", pool.NumThreads(),
+      player.stats.nodes, player.stats.expandMS);
+    printf("Backup: %d threads, %lu nodes, %.1fms\n", pool.NumThreads(),
+      player.stats.nodes, player.stats.backupMS);
+  }
+}
+
+// The TimeBackup search with the tree on plain, transparent huge and
+// explicit huge pages, and where the tree's pages ended up.
+static void TimeLargePages()
+{
+  Board b;
+  b.SetRow(0, 1,2,3,0);
+  b.SetRow(1, 0,1,5,2);
+  b.SetRow(2, 4,0,0,1);
+  b.SetRow(3, 2,0,0,0);
+  b.score = 300;
+
+  const char* Names[3] = { "normal", "transparent", "explicit" };
+  const PageMode mode = GetPageMode();
+  for(int i=0; i<3; ++i){
+    SetPageMode((PageMode)i);
+    ThreadPool pool(0);
+    SearchPlayer player(&pool);
+    player.bVerbose = false;
+    player.timeManager.baseMS = 1e9;
+    player.maxMoveDepth = 5;
+    player.FindBestMove(b);
+    printf("Pages %-11s: expand %.1fms, backup %.1fms  ", Names[i], player.stats.expandMS,
+      player.stats.backupMS);
+    PrintPageStats();
+    std::vector<size_t> counts;
+    if (player.TreePagesByNode(&counts)) {
+      printf("  tree pages by node:");
+      for(size_t n=0; n<counts.size(); ++n) printf(" %lu", (unsigned long)counts[n]);
+      printf("\n");
+    }
+  }
+  SetPageMode(mode);
+}
+
+// Dedup of the kids of a frontier of about a million boards: a node-based
+// hash map and the flat table probed in frontier order, where nearly every
+// probe misses the cache, then the table sized up front and probed one
+// L2-sized region at a time with prefetching, as ExpandMoves does.  The
+// frontier is boards from random games, so the kids are mostly distinct.
+static void TimeFrontierDedup()
+{
+  const size_t NumParents = 1 << 20;
+  const size_t RegionBytes = 256 * 1024;
+  const size_t Distance = 8;
+  RNG rng(7);
+  std::vector<uint64_t> keys; // canonical kids, in frontier order
+  RandomPlayer player;
+  for(size_t nParents=0; nParents<NumParents; ){
+    Board b;
+    b.AddRandomTile(rng);
+    b.AddRandomTile(rng);
+    Direction dir;
+    while(nParents < NumParents && (dir = player.FindBestMove(b)) != None){
+      Board succ[NumDirections];
+      const int legal = b.GenerateMoves(succ);
+      for(int d=0; d<NumDirections; ++d)
+        if (legal & (1 << d)) keys.push_back(succ[d].GetCanonical().Bits());
+      ++nParents;
+      b.Slide(dir);
+      b.AddRandomTile(rng);
+    }
+  }
+
+  for(int iRun=0; iRun<2; ++iRun){
+    clock_t start = clock();
+    std::unordered_map<uint64_t, uint32_t> map;
+    for(size_t i=0; i<keys.size(); ++i) map.insert(std::make_pair(keys[i], (uint32_t)map.size()));
+    const double mapMS = (clock() - start) / CPMS;
+
+    start = clock();
+    NodeTable table;
+    bool bInserted;
+    for(size_t i=0; i<keys.size(); ++i) table.Insert(keys[i], (uint32_t)table.Size(), &bInserted);
+    const double tableMS = (clock() - start) / CPMS;
+
+    start = clock();
+    NodeTable regions;
+    regions.Reset(keys.size());
+    int partBits = 0;
+    while((regions.Bytes() >> partBits) > RegionBytes) ++partBits;
+    std::vector<size_t> partStart(((size_t)1 << partBits) + 1, 0);
+    std::vector<std::pair<uint64_t, uint64_t> > parts(keys.size()); // (hash, key)
+    for(size_t i=0; i<keys.size(); ++i) ++partStart[(NodeTable::Hash(keys[i]) >> (64 - partBits)) + 1];
+    for(size_t p=1; p<partStart.size(); ++p) partStart[p] += partStart[p-1];
+    for(size_t i=0; i<keys.size(); ++i){
+      const uint64_t hash = NodeTable::Hash(keys[i]);
+      parts[partStart[hash >> (64 - partBits)]++] = std::make_pair(hash, keys[i]);
+    }
+    for(size_t j=0; j<parts.size(); ++j){
+      if (j + Distance < parts.size()) regions.Prefetch(parts[j + Distance].first);
+      regions.Insert(parts[j].second, parts[j].first, (uint32_t)regions.Size(), &bInserted);
+    }
+    const double regionMS = (clock() - start) / CPMS;
+
+    printf("Frontier dedup, %lu kids, %lu distinct: unordered_map %.1fms, table %.1fms, "
+      "by region %.1fms\n", (unsigned long)keys.size(), (unsigned long)regions.Size(),
+      mapMS, tableMS, regionMS);
+  }
+}
+
+// Chance-node backup over about a million parents with float values and
+// the weights normalized by a divide, with the weights pre-normalized, and
+// with compact values, and the error the compact values make.  Kid scores are
+// evals of real boards; a few kids have a chance of dying.
+static void TimeCompactBackup()
+{
+  const size_t NumParents = 1 << 20;
+  const int NumReps = 5;
+  RNG rng(11);
+  RandomPlayer player;
+  std::vector<uint32_t> firstKid, numKids;
+  std::vector<uint64_t> kidBoards;
+  std::vector<byte> weight;
+  while(firstKid.size() < NumParents){
+    Board b;
+    b.AddRandomTile(rng);
+    b.AddRandomTile(rng);
+    Direction dir;
+    while(firstKid.size() < NumParents && (dir = player.FindBestMove(b)) != None){
+      b.Slide(dir);
+      byte cells[16], weights[16];
+      const int nCells = b.GetSpawnCells(cells, weights);
+      firstKid.push_back((uint32_t)kidBoards.size());
+      numKids.push_back(2 * nCells);
+      for(int j=0; j<nCells; ++j){
+        for(uint64_t tile=1; tile<=2; ++tile){
+          kidBoards.push_back(b.Bits() | (tile << (4 * cells[j])));
+          weight.push_back(weights[j]);
+        }
+      }
+      b.AddRandomTile(rng);
+    }
+  }
+
+  const size_t n = kidBoards.size();
+  std::vector<int> gameScores(n, 1000);
+  std::vector<float> score(n), death(n);
+  BatchEval::Eval(&kidBoards[0], &gameScores[0], n, &score[0]);
+  for(size_t i=0; i<n; ++i) death[i] = (rng.NextInt() % 16 == 0 ? rng.NextFloat() : 0.0f);
+  std::vector<CompactScore> cScore(n);
+  std::vector<CompactDeath> cDeath(n);
+  for(size_t i=0; i<n; ++i){
+    cScore[i] = PackScore(score[i]);
+    cDeath[i] = PackDeath(death[i]);
+  }
+
+  const float Prob[2] = { 0.9f, 0.1f };
+  float inv[17] = { 0.0f };
+  for(int i=1; i<=16; ++i) inv[i] = 1.0f / i;
+  std::vector<float> outScore(NumParents), outDeath(NumParents);
+  std::vector<float> outScore2(NumParents), outDeath2(NumParents);
+  std::vector<CompactScore> outCScore(NumParents);
+  std::vector<CompactDeath> outCDeath(NumParents);
+
+  clock_t start = clock();
+  for(int rep=0; rep<NumReps; ++rep){
+    for(size_t i=0; i<NumParents; ++i){
+      const uint32_t first = firstKid[i];
+      float wsum = 0.0f, s = 0.0f, d = 0.0f;
+      for(uint32_t j=0; j<numKids[i]; ++j){
+        const float p = Prob[j & 1] * weight[first + j];
+        wsum += p;
+        s += p * score[first + j];
+        d += p * death[first + j];
+      }
+      outScore[i] = s / wsum;
+      outDeath[i] = d / wsum;
+    }
+  }
+  const double floatMS = (clock() - start) / CPMS / NumReps;
+
+  start = clock();
+  for(int rep=0; rep<NumReps; ++rep){
+    for(size_t i=0; i<NumParents; ++i){
+      const uint32_t first = firstKid[i];
+      int nCells = 0;
+      float s = 0.0f, d = 0.0f;
+      for(uint32_t j=first; j<first + numKids[i]; j+=2){
+        const int w = weight[j];
+        nCells += w;
+        s += w * (0.9f * score[j] + 0.1f * score[j+1]);
+        d += w * (0.9f * death[j] + 0.1f * death[j+1]);
+      }
+      outScore2[i] = s * inv[nCells];
+      outDeath2[i] = d * inv[nCells];
+    }
+  }
+  const double scaledMS = (clock() - start) / CPMS / NumReps;
+
+  start = clock();
+  for(int rep=0; rep<NumReps; ++rep){
+    for(size_t i=0; i<NumParents; ++i){
+      const uint32_t first = firstKid[i];
+      int nCells = 0;
+      float s = 0.0f, d = 0.0f;
+      for(uint32_t j=first; j<first + numKids[i]; j+=2){
+        const int w = weight[j];
+        nCells += w;
+        s += w * (0.9f * cScore[j] + 0.1f * cScore[j+1]);
+        d += w * (0.9f * cDeath[j] + 0.1f * cDeath[j+1]);
+      }
+      outCScore[i] = PackScore(UnpackScore(1) * s * inv[nCells]);
+      outCDeath[i] = PackDeath(UnpackDeath(1) * d * inv[nCells]);
+    }
+  }
+  const double compactMS = (clock() - start) / CPMS / NumReps;
+
+  double maxScoreErr = 0.0, sumScoreErr = 0.0, maxDeathErr = 0.0;
+  for(size_t i=0; i<NumParents; ++i){
+    const double e = fabs(UnpackScore(outCScore[i]) - outScore[i]);
+    maxScoreErr = std::max(maxScoreErr, e);
+    sumScoreErr += e;
+    maxDeathErr = std::max(maxDeathErr, (double)fabs(UnpackDeath(outCDeath[i]) - outDeath[i]));
+  }
+  printf("Chance backup, %lu kids: float %.1fms, float pre-normalized %.1fms (%lu bytes/node), "
+    "compact %.1fms (%lu bytes/node)\n", (unsigned long)n, floatMS, scaledMS,
+    (unsigned long)(2 * sizeof(float)), compactMS,
+    (unsigned long)(sizeof(CompactScore) + sizeof(CompactDeath)));
+  printf("  compact error: score max %.5f mean %.5f, death max %.6f\n",
+    maxScoreErr, sumScoreErr / NumParents, maxDeathErr);
+}
+
+// Backup time and eval cache hit rate over a short game for a range of
+// cache sizes, to tune the size against L2/L3.
+static void TimeEvalCache()
+{
+  const size_t Sizes[] = { 0, 1 << 12, 1 << 14, 1 << 16, 1 << 20 };
+  for(size_t k=0; k<sizeof(Sizes)/sizeof(Sizes[0]); ++k){
+    ThreadPool pool(1);
+    SearchPlayer player(&pool);
+    player.timeManager.baseMS = 1e9;
+    player.maxMoveDepth = 4;
+    player.SetEvalCacheSize(Sizes[k]);
+
+    RNG rng(5);
+    Board b;
+    b.AddRandomTile(rng);
+    b.AddRandomTile(rng);
+    double backupMS = 0.0;
+    size_t hits = 0, misses = 0;
+    for(int i=0; i<20; ++i){
+      Direction dir = player.FindBestMove(b);
+      if (dir == None) break;
+      backupMS += player.stats.backupMS;
+      hits += player.stats.evalHits;
+      misses += player.stats.evalMisses;
+      b.Slide(dir);
+      b.AddRandomTile(rng);
+    }
+    printf("Eval cache: %8lu entries, backup %.1fms, %.1f%% hits\n", (unsigned long)Sizes[k],
+      backupMS, 100.0 * hits / std::max(hits + misses, (size_t)1));
+  }
+}
+
+// Scalar Eval vs. BatchEval on boards from random games.
+static void TimeEval()
+{
+  const int NumBoards = 1 << 16;
+  const int NumReps = 16;
+  RNG rng(7);
+  std::vector<uint64_t> boards(NumBoards);
+  std::vector<int> scores(NumBoards);
+  Board b;
+  for(int i=0; i<NumBoards; ++i){
+    Direction dirs[4];
+    int n = b.GetLegalMoves(dirs);
+    if (n == 0) {
+      b.Reset();
+      b.AddRandomTile(rng);
+      b.AddRandomTile(rng);
+      n = b.GetLegalMoves(dirs);
+    }
+    b.Slide(dirs[rng.NextInt() % n]);
+    b.AddRandomTile(rng);
+    boards[i] = b.Bits();
+    scores[i] = b.score;
+  }
+
+  std::vector<float> out(NumBoards);
+  clock_t start = clock();
+  for(int rep=0; rep<NumReps; ++rep){
+    for(int i=0; i<NumBoards; ++i){
+      b.SetBits(boards[i]);
+      b.score = scores[i];
+      out[i] = SearchPlayer::Eval(b);
+    }
+  }
+  double ms = (clock() - start) / CPMS;
+  printf("Scalar eval: %.1fms (%.1fM boards/s)\n", ms, NumBoards * NumReps / ms / 1000.0);
+
+  start = clock();
+  for(int rep=0; rep<NumReps; ++rep)
+    BatchEval::Eval(&boards[0], &scores[0], NumBoards, &out[0]);
+  ms = (clock() - start) / CPMS;
+  printf("Batch eval: %.1fms (%.1fM boards/s)\n", ms, NumBoards * NumReps / ms / 1000.0);
+}
+
+// The slide tables as they were before they were merged: the new row and
+// the score in two separate tables, two loads per row.
+struct SplitSlideTables
+{
+  SplitSlideTables() : move(65536), score(65536) {
+    for(int r=0; r<65536; ++r){
+      move[r] = Board::SlideRowLeft((ushort)r);
+      score[r] = Board::SlideRowLeftScore((ushort)r);
+    }
+  }
+  ushort Slide(ushort row, int* gain) const { *gain += score[row]; return move[row]; }
+  std::vector<ushort> move;
+  std::vector<int> score;
+};
+
+struct MergedSlideTables
+{
+  ushort Slide(ushort row, int* gain) const {
+    *gain += Board::SlideRowLeftScore(row);
+    return Board::SlideRowLeft(row);
+  }
+};
+
+// Slides the rows of src left (or right, reversed) with the given tables.
+template<class Tables>
+static uint64_t SlideRows(const Tables& tables, uint64_t src, bool bReverse, int* gain)
+{
+  uint64_t to = 0;
+  for(int i=0; i<4; ++i){
+    ushort row = (ushort)(src >> (16*i));
+    if (bReverse) row = Reverse(row);
+    ushort slid = tables.Slide(row, gain);
+    if (bReverse) slid = Reverse(slid);
+    to |= (uint64_t)slid << (16*i);
+  }
+  return to;
+}
+
+// Stand-in for one step of expansion: generate the four successors and
+// look each one up in a hash table the size of the search's working set.
+template<class Tables>
+static double TimeExpansion(const Tables& tables, const std::vector<uint64_t>& boards,
+                            std::vector<uint64_t>& table, long long* check)
+{
+  const size_t mask = table.size() - 1;
+  long long sum = 0;
+  clock_t start = clock();
+  for(size_t i=0; i<boards.size(); ++i){
+    const uint64_t b = boards[i];
+    const uint64_t t = Board::Transpose(b);
+    int gain = 0;
+    uint64_t succ[NumDirections];
+    succ[Left] = SlideRows(tables, b, false, &gain);
+    succ[Right] = SlideRows(tables, b, true, &gain);
+    succ[Up] = Board::Transpose(SlideRows(tables, t, false, &gain));
+    succ[Down] = Board::Transpose(SlideRows(tables, t, true, &gain));
+    for(int dir=0; dir<NumDirections; ++dir){
+      if (succ[dir] == b) continue;
+      uint64_t& slot = table[(succ[dir] * 0x9E3779B97F4A7C15ull >> 20) & mask];
+      sum += (slot == succ[dir]);
+      slot = succ[dir];
+    }
+    sum += gain;
+  }
+  *check += sum;
+  return (clock() - start) / CPMS;
+}
+
+// Split vs. merged slide tables with a growing working set competing for
+// the cache, as the dedup map and ply arrays do during a search.
+static void TimeSlideTables()
+{
+  const int NumBoards = 1 << 21;
+  RNG rng(11);
+  std::vector<uint64_t> boards(NumBoards);
+  Board b;
+  for(int i=0; i<NumBoards; ++i){
+    Direction dirs[4];
+    int n = b.GetLegalMoves(dirs);
+    if (n == 0) {
+      b.Reset();
+      b.AddRandomTile(rng);
+      b.AddRandomTile(rng);
+      n = b.GetLegalMoves(dirs);
+    }
+    b.Slide(dirs[rng.NextInt() % n]);
+    b.AddRandomTile(rng);
+    boards[i] = b.Bits();
+  }
+
+  const SplitSlideTables split;
+  const MergedSlideTables merged;
+  const size_t WorkingSetKB[] = { 64, 256, 1024, 4096, 32768 };
+  for(size_t k=0; k<sizeof(WorkingSetKB)/sizeof(WorkingSetKB[0]); ++k){
+    std::vector<uint64_t> table(WorkingSetKB[k] * 1024 / sizeof(uint64_t), 0);
+    long long check = 0;
+    double splitMS = 1e30, mergedMS = 1e30;
+    for(int rep=0; rep<3; ++rep){
+      splitMS = std::min(splitMS, TimeExpansion(split, boards, table, &check));
+      mergedMS = std::min(mergedMS, TimeExpansion(merged, boards, table, &check));
+    }
+    printf("Slide tables, %5luKB working set: split %.1fms, merged %.1fms (%lld)\n",
+      (unsigned long)WorkingSetKB[k], splitMS, mergedMS, check);
+  }
+}
+
+void RunBenchmarks()
+{
+  TimeMoveSpeed();
+  TimeSlideTables();
+  TimePlayouts();
+  TimeBackup();
+  TimeLargePages();
+  TimeFrontierDedup();
+  TimeCompactBackup();
+  TimeEval();
+  TimeEvalCache();
+}
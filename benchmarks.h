@@ -0,0 +1,6 @@
+#ifndef __BENCHMARKS_H__
+#define __BENCHMARKS_H__
+
+void RunBenchmarks();
+
+#endif
@@ -6,6 +6,7 @@
 
 #include "board.h"
 #include "rng.h"
+#include "trace.h"
 
 #define Width 4
 #define Height 4
@@ -52,8 +53,7 @@ ushort RowVal(ushort row, int x)
 ////////////////////////////////////////////////////////////
 // Static Declarations
 
-ushort Board::moveLeftLUT[65536];
-int Board::scoreLeftLUT[65536];
+uint32_t Board::slideLeftLUT[65536];
 
 void Board::Init()
 {
@@ -71,8 +71,8 @@ void Board::Init()
             ushort to = from;
             int score = 0;
             Board::SlideLeftSlow(&to, &score);            
-            Board::moveLeftLUT[from] = to;
-            Board::scoreLeftLUT[from] = score;
+            assert((score & 3) == 0 && (score >> 2) <= 0xFFFF);
+            Board::slideLeftLUT[from] = to | ((uint32_t)(score >> 2) << 16);
         }
       }
     }
@@ -197,7 +197,7 @@ void Board::SetCell(int x, int y, ushort v)
 
 bool Board::HasOpenTiles() const
 {  
-  uint64_t b = *(uint64_t*)board;
+  uint64_t b = Bits();
   for(int i=0; i<16; ++i){
     if ((b & 0xF) == 0) return true;
     b >>= 4;
@@ -207,7 +207,7 @@ bool Board::HasOpenTiles() const
 
 int Board::NumAvailableTiles() const
 {
-  uint64_t b = *(uint64_t*)board;
+  uint64_t b = Bits();
   int n = 0;
   for(int i=0; i<16; ++i){
     if ((b & 0xF) == 0) ++n;
@@ -218,7 +218,7 @@ int Board::NumAvailableTiles() const
 
 int Board::GetAvailableTiles(byte* list) const
 {
-  uint64_t b = *(uint64_t*)board;
+  uint64_t b = Bits();
   int n = 0;
   for(int i=0; i<16; ++i){
     if ((b & 0xF) == 0) list[n++] = i;
@@ -228,9 +228,39 @@ int Board::GetAvailableTiles(byte* list) const
   return n;
 }
 
+int Board::GetSpawnCells(byte* cells, byte* weights) const
+{
+  const int syms = Symmetries(Bits());
+  if (syms == 1) {
+    const int n = GetAvailableTiles(cells);
+    for(int i=0; i<n; ++i) weights[i] = 1;
+    return n;
+  }
+
+  // A symmetry of the board maps open cells to open cells, so each open
+  // cell not yet seen starts a new orbit.
+  byte avail[16];
+  const int nAvail = GetAvailableTiles(avail);
+  int seen = 0, n = 0;
+  for(int i=0; i<nAvail; ++i){
+    if (seen & (1 << avail[i])) continue;
+    int size = 0;
+    for(int sym=0; sym<8; ++sym){
+      const int bit = 1 << TransformCell(avail[i], sym);
+      if ((syms & (1 << sym)) && !(seen & bit)) {
+        seen |= bit;
+        ++size;
+      }
+    }
+    cells[n] = avail[i];
+    weights[n++] = (byte)size;
+  }
+  return n;
+}
+
 byte Board::MaxTile() const
 {
-  uint64_t b = *(uint64_t*)board;
+  uint64_t b = Bits();
   int vmax = 0;
   for(int i=0; i<16; ++i){
     int v = (b & 0xF);
@@ -242,12 +272,80 @@ byte Board::MaxTile() const
 
 int Board::GetLegalMoves(Direction* moves) const
 {
+  const int mask = LegalMoveMask();
   int n = 0;
   for(int i=0; i<NumDirections; ++i)
-    if (CanSlide((Direction)i)) moves[n++] = (Direction)i;
+    if (mask & (1 << i)) moves[n++] = (Direction)i;
   return n;
 }
 
+int Board::LegalMoveMask() const
+{
+  const uint64_t b = Bits();
+  const uint64_t t = Transpose(b);
+  int mask = 0;
+  for(int i=0; i<Height; ++i){
+    const ushort row = (ushort)(b >> (16*i));
+    const ushort col = (ushort)(t >> (16*i));
+    const ushort rrow = Reverse(row);
+    const ushort rcol = Reverse(col);
+    mask |= ((ushort)slideLeftLUT[row] != row) << Left;
+    mask |= ((ushort)slideLeftLUT[rrow] != rrow) << Right;
+    mask |= ((ushort)slideLeftLUT[col] != col) << Up;
+    mask |= ((ushort)slideLeftLUT[rcol] != rcol) << Down;
+  }
+  return mask;
+}
+
+int Board::GenerateMoves(Board* succ) const
+{
+  uint64_t b[NumDirections];
+  int gains[NumDirections];
+  const int mask = GenerateMoves(Bits(), b, gains);
+  for(int i=0; i<NumDirections; ++i){
+    succ[i].SetBits(b[i]);
+    succ[i].score = score + gains[i];
+  }
+  return mask;
+}
+
+// Slides every row (Left/Right) or column (Up/Down) of b; t is the
+// transpose of b, whose rows are b's columns.
+template<Direction dir>
+uint64_t Board::SlideBits(uint64_t b, uint64_t t, int* gain)
+{
+  const bool bCols = (dir == Up || dir == Down);
+  const bool bReverse = (dir == Right || dir == Down);
+  const uint64_t src = (bCols ? t : b);
+  uint64_t to = 0;
+  for(int i=0; i<4; ++i){
+    ushort row = (ushort)(src >> (16*i));
+    if (bReverse) row = Reverse(row);
+    const uint32_t entry = slideLeftLUT[row];
+    ushort slid = (ushort)entry;
+    *gain += SlideScore(entry);
+    if (bReverse) slid = Reverse(slid);
+    to |= (uint64_t)slid << (16*i);
+  }
+  return bCols ? Transpose(to) : to;
+}
+
+int Board::GenerateMoves(uint64_t b, uint64_t* succ, int* gains)
+{
+  return GenerateMoves(b, Transpose(b), succ, gains);
+}
+
+int Board::GenerateMoves(uint64_t b, uint64_t t, uint64_t* succ, int* gains)
+{
+  gains[Left] = gains[Right] = gains[Up] = gains[Down] = 0;
+  succ[Left] = SlideBits<Left>(b, t, &gains[Left]);
+  succ[Right] = SlideBits<Right>(b, t, &gains[Right]);
+  succ[Up] = SlideBits<Up>(b, t, &gains[Up]);
+  succ[Down] = SlideBits<Down>(b, t, &gains[Down]);
+  return (succ[Left] != b) << Left | (succ[Right] != b) << Right
+    | (succ[Up] != b) << Up | (succ[Down] != b) << Down;
+}
+
 bool Board::AddRandomTile(RNG& rng)
 {
   byte list[16];
@@ -328,10 +426,16 @@ int Board::CornerScore() const
   return score;
 }
 
+int Board::CornerWeight(int ix)
+{
+  assert(ix>=0 && ix<16);
+  return CornerScoreTileValue[ix];
+}
+
 int Board::CalcCornerScore() const
 {
   int score = 0;
-  uint64_t b = *(uint64_t*)board;
+  uint64_t b = Bits();
   for(int i=0; i<16; ++i) {
     score += CornerScoreTileValue[i] * (1 << (b & 0xF));
     b >>= 4;
@@ -342,7 +446,7 @@ int Board::CalcCornerScore() const
 int Board::CanonicalScore() const
 {
   int score = 0;
-  uint64_t b = *(uint64_t*)board;
+  uint64_t b = Bits();
   for(int i=0; i<16; ++i){
     score += (i+1) * (b & 0xF);
     b >>= 4;
@@ -350,15 +454,18 @@ int Board::CanonicalScore() const
   return score;
 }
 
+// The orientation with the highest CanonicalScore, ties going to the higher
+// bits, so every orientation of a board gives the same result.
 Board Board::GetCanonical() const
 {
+  TRACE_COUNT("GetCanonical", 1);
   Board bestBoard = *this;
   int bestScore = bestBoard.CanonicalScore();
 
   Board b = *this;
   b.ReflectVert();
   int score = b.CanonicalScore();
-  if (score > bestScore) {
+  if (score > bestScore || (score == bestScore && b.Bits() > bestBoard.Bits())) {
     bestScore = score;
     bestBoard = b;
   }
@@ -367,7 +474,7 @@ Board Board::GetCanonical() const
   for (int i=0; i<3; ++i) {
     b.RotateCW();
     int score = b.CanonicalScore();
-    if (score > bestScore) {
+    if (score > bestScore || (score == bestScore && b.Bits() > bestBoard.Bits())) {
       bestScore = score;
       bestBoard = b;
     }
@@ -375,7 +482,7 @@ Board Board::GetCanonical() const
     Board b2 = b;
     b2.ReflectVert();
     score = b2.CanonicalScore();
-    if (score > bestScore) {
+    if (score > bestScore || (score == bestScore && b2.Bits() > bestBoard.Bits())) {
       bestScore = score;
       bestBoard = b2;
     }
@@ -407,8 +514,8 @@ void Board::PrintSmall() const
 
 bool Board::IsDead() const
 {
-  if (NumAvailableTiles() > 0) return false;
-  return !CanSlideLeft() && !CanSlideRight() && !CanSlideUp() && !CanSlideDown();
+  if (HasOpenTiles()) return false;
+  return LegalMoveMask() == 0;
 }
 
 bool Board::CanSlide(Direction dir) const
@@ -437,7 +544,7 @@ bool Board::CanSlideUp() const
 {  
   for (int x = 0; x < Width; ++x) {    
     ushort v = GetCol(x);
-    if (moveLeftLUT[v] != v) return true;
+    if ((ushort)slideLeftLUT[v] != v) return true;
   }
   return false;
 }
@@ -446,7 +553,7 @@ bool Board::CanSlideRight() const
 {
   for (int y = 0; y < Height; ++y){
     ushort row = Reverse(board[y]);    
-    if (moveLeftLUT[row] != row) return true;
+    if ((ushort)slideLeftLUT[row] != row) return true;
   }
   return false;
 }
@@ -455,7 +562,7 @@ bool Board::CanSlideDown() const
 {  
   for (int x = 0; x < Width; ++x) {    
     ushort v = GetReverseCol(x);
-    if (moveLeftLUT[v] != v) return true;
+    if ((ushort)slideLeftLUT[v] != v) return true;
   }
   return false;
 }
@@ -464,7 +571,7 @@ bool Board::CanSlideLeft() const
 {
   for (int y = 0; y < Height; ++y){
     ushort row = board[y];
-    if (moveLeftLUT[row] != row) return true;
+    if ((ushort)slideLeftLUT[row] != row) return true;
   }
   return false;
 }
@@ -492,19 +599,21 @@ bool Board::SlideLeft()
 bool Board::SlideUp(int iCol)
 {  
   ushort from = GetCol(iCol);
-  ushort to = Board::moveLeftLUT[from];
+  const uint32_t entry = Board::slideLeftLUT[from];
+  ushort to = (ushort)entry;
   if (from == to) return false;
   SetCol(iCol, to);
-  score += Board::scoreLeftLUT[from];
+  score += SlideScore(entry);
   return true;
 }
 
 bool Board::SlideRight(int iRow)
 {
   ushort from = Reverse(board[iRow]);  
-  ushort to = Board::moveLeftLUT[from];
+  const uint32_t entry = Board::slideLeftLUT[from];
+  ushort to = (ushort)entry;
   if (from == to) return false;
-  score += Board::scoreLeftLUT[from];  
+  score += SlideScore(entry);  
   board[iRow] = Reverse(to);
   return true;
 }
@@ -512,20 +621,22 @@ bool Board::SlideRight(int iRow)
 bool Board::SlideDown(int iCol)
 {  
   ushort from = GetReverseCol(iCol);
-  ushort to = Board::moveLeftLUT[from];
+  const uint32_t entry = Board::slideLeftLUT[from];
+  ushort to = (ushort)entry;
   if (from == to) return false;
   SetCol(iCol, Reverse(to));
-  score += Board::scoreLeftLUT[from];
+  score += SlideScore(entry);
   return true;
 }
 
 bool Board::SlideLeft(int iRow)
 {
   ushort from = board[iRow];
-  ushort to = Board::moveLeftLUT[from];
+  const uint32_t entry = Board::slideLeftLUT[from];
+  ushort to = (ushort)entry;
   if (from == to) return false;
   board[iRow] = to; 
-  score += Board::scoreLeftLUT[from];
+  score += SlideScore(entry);
   return true;
 }
 
@@ -537,6 +648,48 @@ void Board::RotateCW()
     SetCol(3-i, b[i]);
 }
 
+// Swaps rows and columns: row i of the result is column i of the input.
+uint64_t Board::Transpose(uint64_t b)
+{
+  uint64_t a1 = b & 0xF0F00F0FF0F00F0FULL;
+  uint64_t a2 = b & 0x0000F0F00000F0F0ULL;
+  uint64_t a3 = b & 0x0F0F00000F0F0000ULL;
+  uint64_t a = a1 | (a2 << 12) | (a3 >> 12);
+  uint64_t b1 = a & 0xFF00FF0000FF00FFULL;
+  uint64_t b2 = a & 0x00FF00FF00000000ULL;
+  uint64_t b3 = a & 0x00000000FF00FF00ULL;
+  return b1 | (b2 >> 24) | (b3 << 24);
+}
+
+uint64_t Board::Transform(uint64_t b, int sym)
+{
+  if (sym & 1) {
+    b = ((b & 0x0F0F0F0F0F0F0F0FULL) << 4) | ((b >> 4) & 0x0F0F0F0F0F0F0F0FULL);
+    b = ((b & 0x00FF00FF00FF00FFULL) << 8) | ((b >> 8) & 0x00FF00FF00FF00FFULL);
+  }
+  if (sym & 2) {
+    b = (b << 32) | (b >> 32);
+    b = ((b & 0x0000FFFF0000FFFFULL) << 16) | ((b >> 16) & 0x0000FFFF0000FFFFULL);
+  }
+  return (sym & 4) ? Transpose(b) : b;
+}
+
+int Board::TransformCell(int ix, int sym)
+{
+  int x = ix & 3, y = ix >> 2;
+  if (sym & 1) x = 3 - x;
+  if (sym & 2) y = 3 - y;
+  return (sym & 4) ? 4*x + y : 4*y + x;
+}
+
+int Board::Symmetries(uint64_t b)
+{
+  int mask = 1;
+  for(int sym=1; sym<8; ++sym)
+    if (Transform(b, sym) == b) mask |= 1 << sym;
+  return mask;
+}
+
 void Board::ReflectVert()
 {
   ushort t = board[0];
@@ -557,7 +710,7 @@ void Board::ReflectHorz()
 bool Board::operator==(const Board& that) const
 {
   if (this == &that) return true;
-  uint64_t a = *(uint64_t*)board;
-  uint64_t b = *(uint64_t*)that.board;
+  uint64_t a = Bits();
+  uint64_t b = that.Bits();
   return a == b;
 }
@@ -1,6 +1,8 @@
 #ifndef __BOARD_H__
 #define __BOARD_H__
 
+#include <stdint.h>
+#include <string.h>
 #include <vector>
 #include "rng.h"
 
@@ -21,6 +23,8 @@ ushort RowVal(ushort row, int x);
 class Board
 {
 public:
+  static const int NumCells = 16;
+
   static void Init();
 
   Board();  
@@ -41,7 +45,13 @@ public:
   bool HasOpenTiles() const;
   int NumAvailableTiles() const;
   int GetAvailableTiles(byte* list) const;
+  // Open cells up to the board's own symmetries: one cell of each orbit in
+  // cells, and the size of the orbit in weights.  Returns the number of
+  // orbits.  Spawns in the cells of one orbit give equivalent boards.
+  int GetSpawnCells(byte* cells, byte* weights) const;
   int GetLegalMoves(Direction* moves) const;
+  int LegalMoveMask() const;
+  int GenerateMoves(Board* succ) const;
   bool AddRandomTile(RNG& rng);
 
   bool IsDead() const;
@@ -69,12 +79,35 @@ public:
 
   int SmoothnessScore() const;
   int CornerScore() const;
+  static int CornerWeight(int ix);
   int CanonicalScore() const;
   Board GetCanonical() const;
 
   byte MaxTile() const;
   int Score() const { return score; }
 
+  // Through memcpy, as reading the rows through a uint64_t* breaks strict
+  // aliasing; compilers turn it into a single load or store.
+  uint64_t Bits() const { uint64_t b; memcpy(&b, board, sizeof(b)); return b; }
+  void SetBits(uint64_t b) { memcpy(board, &b, sizeof(b)); }
+
+  static uint64_t Transpose(uint64_t b);
+  // The symmetries of the square as 3 bits: 1 reverses each row, 2 reverses
+  // the order of the rows, and 4 then transposes.  0 is the identity.
+  static uint64_t Transform(uint64_t b, int sym);
+  static int TransformCell(int ix, int sym);
+  // Mask with bit sym set for each symmetry that leaves b unchanged.
+  static int Symmetries(uint64_t b);
+  static ushort SlideRowLeft(ushort row) { return (ushort)slideLeftLUT[row]; }
+  static int SlideRowLeftScore(ushort row) { return SlideScore(slideLeftLUT[row]); }
+
+  // Computes the board after each of the four moves in one pass over the
+  // rows and columns.  succ[dir] gets the new board and gains[dir] the score
+  // for the move.  Returns a mask with bit dir set for each legal move.
+  // The second form takes the transposed board if the caller already has it.
+  static int GenerateMoves(uint64_t b, uint64_t* succ, int* gains);
+  static int GenerateMoves(uint64_t b, uint64_t t, uint64_t* succ, int* gains);
+
   static bool SlideLeftSlow(ushort* row, int* score);
   static bool SlideLeftSlow(byte* p, int* score);
 
@@ -86,15 +119,21 @@ public:
 private:
   int CalcCornerScore() const;
 
-  static ushort moveLeftLUT[];    
-  static int scoreLeftLUT[];    
+  template<Direction dir> static uint64_t SlideBits(uint64_t b, uint64_t t, int* gain);
+
+  // Result of sliding each row left: the new row in the low 16 bits and the
+  // score divided by 4 in the high 16 bits, so one load gives both.  Every
+  // merge scores a multiple of 4 and a row scores at most 2*65536, so the
+  // score fits.  256 KB, against 384 KB for separate row and score tables.
+  static uint32_t slideLeftLUT[];
+  static int SlideScore(uint32_t entry) { return (int)(entry >> 16) << 2; }
 };
 
 namespace std {
   template <>
   struct hash<Board>{
     size_t operator()(const Board &b) const {
-      return *(size_t*)b.board;
+      return (size_t)b.Bits();
     }
   };
 }
@@ -0,0 +1,360 @@
+#ifndef __BOARD_T_H__
+#define __BOARD_T_H__
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "board.h"
+#include "rng.h"
+
+// Boards of other sizes and tile ranges.  Board stays the hand-tuned 4x4
+// board with 4-bit cells; BoardT<W,H,CellBits> is the general version, with
+// every size fixed at compile time so loops over cells and lines unroll and
+// each instantiation gets its own slide tables.  A cell holds the log2 of
+// its tile, so 5-bit cells go up to 2^31.
+
+// Smallest unsigned type that holds a line of the given number of bits.
+template<int Bits, bool bSmall = (Bits <= 16), bool bMedium = (Bits <= 32)>
+struct LineType { typedef uint64_t type; };
+template<int Bits> struct LineType<Bits, false, true> { typedef uint32_t type; };
+template<int Bits> struct LineType<Bits, true, true> { typedef uint16_t type; };
+
+// Slides a line of N cells.  Lines of up to 20 bits go through a table with
+// the slid line and the score in one entry, as Board does; longer lines
+// (e.g. 5x5 with 5-bit cells) would need a table of 32M+ entries, so they
+// are slid cell by cell.
+template<int N, int CellBits>
+class SlideTable
+{
+public:
+  static const int LineBits = N * CellBits;
+  static const int MaxVal = (1 << CellBits) - 1;
+  static const bool bTable = (LineBits <= 20);
+  static const uint32_t CellMask = (1u << CellBits) - 1;
+  typedef typename LineType<LineBits>::type Line;
+
+  static_assert(CellBits >= 4 && CellBits <= 5, "cells hold 4 or 5 bits");
+  static_assert(LineBits <= 64, "line too long");
+
+  static void Init()
+  {
+    if (!bTable || !table.empty()) return;
+    table.resize((size_t)1 << LineBits);
+    for(size_t from=0; from<table.size(); ++from){
+      long long score = 0;
+      table[from].to = SlideLeftSlow((Line)from, &score);
+      table[from].score4 = (uint32_t)(score >> 2);
+    }
+  }
+
+  static int Cell(Line line, int i) { return (int)((line >> (i*CellBits)) & CellMask); }
+
+  static Line Reverse(Line line)
+  {
+    Line r = 0;
+    for(int i=0; i<N; ++i)
+      r |= (Line)Cell(line, i) << ((N-1-i)*CellBits);
+    return r;
+  }
+
+  // Slides the line toward cell 0 and adds the merge score to *score.
+  static Line SlideLeft(Line line, long long* score)
+  {
+    if (!bTable) return SlideLeftSlow(line, score);
+    const Entry& e = table[line];
+    *score += (long long)e.score4 << 2;
+    return e.to;
+  }
+
+  static Line SlideRight(Line line, long long* score)
+  {
+    return Reverse(SlideLeft(Reverse(line), score));
+  }
+
+  // Same rules as Board::SlideLeftSlow, except two tiles of the largest
+  // value a cell can hold don't merge.
+  static Line SlideLeftSlow(Line line, long long* score)
+  {
+    int v[N];
+    int n = 0;
+    for(int i=0; i<N; ++i){
+      const int c = Cell(line, i);
+      if (c == 0) continue;
+      if (n > 0 && v[n-1] == c && c < MaxVal) {
+        v[n-1] = -(c + 1); // merged; can't merge again
+        *score += 1LL << (c + 1);
+      } else {
+        v[n++] = c;
+      }
+    }
+    Line to = 0;
+    for(int i=0; i<n; ++i)
+      to |= (Line)(v[i] < 0 ? -v[i] : v[i]) << (i*CellBits);
+    return to;
+  }
+
+private:
+  // Every merge scores a multiple of 4, and a merge scores at most 2^31,
+  // so the score of a line fits in 32 bits once divided by 4.
+  struct Entry { Line to; uint32_t score4; };
+  static std::vector<Entry> table;
+};
+
+template<int N, int CellBits>
+std::vector<typename SlideTable<N, CellBits>::Entry> SlideTable<N, CellBits>::table;
+
+template<int W, int H, int CellBits>
+class BoardT
+{
+public:
+  static const int Width = W;
+  static const int Height = H;
+  static const int NumCells = W * H;
+  static const int MaxVal = (1 << CellBits) - 1;
+  typedef SlideTable<W, CellBits> RowTable;
+  typedef SlideTable<H, CellBits> ColTable;
+  typedef typename RowTable::Line Row;
+  typedef typename ColTable::Line Col;
+
+  static void Init() { RowTable::Init(); ColTable::Init(); }
+
+  BoardT() { Reset(); }
+
+  void Reset()
+  {
+    memset(rows, 0, sizeof(rows));
+    score = 0;
+  }
+
+  int GetCell(int x, int y) const { return RowTable::Cell(rows[y], x); }
+
+  void SetCell(int x, int y, int v)
+  {
+    assert(x>=0 && x<W && y>=0 && y<H);
+    assert(v>=0 && v<=MaxVal);
+    const int shift = x * CellBits;
+    rows[y] = (Row)((rows[y] & ~((Row)RowTable::CellMask << shift)) | ((Row)v << shift));
+  }
+
+  void SetCell(int ix, int v) { SetCell(ix % W, ix / W, v); }
+
+  void SetRow(int y, Row row) { rows[y] = row; }
+  Row GetRow(int y) const { return rows[y]; }
+
+  Col GetCol(int x) const
+  {
+    Col c = 0;
+    for(int y=0; y<H; ++y)
+      c |= (Col)GetCell(x, y) << (y*CellBits);
+    return c;
+  }
+
+  void SetCol(int x, Col c)
+  {
+    for(int y=0; y<H; ++y)
+      SetCell(x, y, ColTable::Cell(c, y));
+  }
+
+  int NumAvailableTiles() const
+  {
+    int n = 0;
+    for(int y=0; y<H; ++y)
+      for(int x=0; x<W; ++x)
+        n += (GetCell(x, y) == 0);
+    return n;
+  }
+
+  int GetAvailableTiles(byte* list) const
+  {
+    int n = 0;
+    for(int ix=0; ix<NumCells; ++ix)
+      if (GetCell(ix % W, ix / W) == 0) list[n++] = (byte)ix;
+    return n;
+  }
+
+  int MaxTile() const
+  {
+    int vmax = 0;
+    for(int y=0; y<H; ++y)
+      for(int x=0; x<W; ++x)
+        vmax = std::max(vmax, GetCell(x, y));
+    return vmax;
+  }
+
+  // Same as Board::SmoothnessScore: the differences between neighbouring
+  // tiles.
+  int SmoothnessScore() const
+  {
+    int score = 0;
+    for(int y=0; y<H; ++y){
+      for(int x=0; x<W; ++x){
+        const int v = GetCell(x, y);
+        if (v == 0) continue;
+        if (x+1 < W && GetCell(x+1, y) > 0) score += abs(v - GetCell(x+1, y));
+        if (y+1 < H && GetCell(x, y+1) > 0) score += abs(v - GetCell(x, y+1));
+      }
+    }
+    return score;
+  }
+
+  // Board's corner weights fall along a snake from cell 0; other sizes take
+  // the weight at the same fraction of the way along their own snake, so
+  // 4x4 boards get exactly Board's.
+  static int CornerWeight(int x, int y)
+  {
+    const int rank = y*W + (y % 2 == 0 ? x : W-1-x);
+    const int rank4 = rank * 16 / NumCells;
+    const int y4 = rank4 / 4;
+    return Board::CornerWeight(4*y4 + (y4 % 2 == 0 ? rank4 % 4 : 3 - rank4 % 4));
+  }
+
+  // Same as Board::CornerScore: the tile values weighted by CornerWeight,
+  // best over the reflections of the board and, when square, its
+  // transposes.
+  long long CornerScore() const
+  {
+    long long best = 0;
+    for(int sym=0; sym<(W == H ? 8 : 4); ++sym){
+      long long score = 0;
+      for(int y=0; y<H; ++y){
+        for(int x=0; x<W; ++x){
+          int tx = (sym & 1) ? W-1-x : x;
+          int ty = (sym & 2) ? H-1-y : y;
+          if (sym & 4) std::swap(tx, ty);
+          score += (long long)CornerWeight(tx, ty) << GetCell(x, y);
+        }
+      }
+      best = std::max(best, score);
+    }
+    return best;
+  }
+
+  bool AddRandomTile(RNG& rng)
+  {
+    byte list[NumCells];
+    const int n = GetAvailableTiles(list);
+    if (n < 1) return false;
+    const int ix = list[rng.NextInt() % n];
+    SetCell(ix, rng.NextFloat() < 0.9 ? 1 : 2);
+    return true;
+  }
+
+  bool Slide(Direction dir)
+  {
+    bool bMoved = false;
+    switch(dir){
+    case Left:
+    case Right:
+      for(int y=0; y<H; ++y){
+        const Row from = rows[y];
+        rows[y] = (dir == Left ? RowTable::SlideLeft(from, &score)
+                               : RowTable::SlideRight(from, &score));
+        bMoved |= (rows[y] != from);
+      }
+      break;
+    case Up:
+    case Down:
+      for(int x=0; x<W; ++x){
+        const Col from = GetCol(x);
+        const Col to = (dir == Up ? ColTable::SlideLeft(from, &score)
+                                  : ColTable::SlideRight(from, &score));
+        if (to == from) continue;
+        SetCol(x, to);
+        bMoved = true;
+      }
+      break;
+    default:
+      break;
+    }
+    return bMoved;
+  }
+
+  bool CanSlide(Direction dir) const
+  {
+    long long s = 0;
+    switch(dir){
+    case Left:
+      for(int y=0; y<H; ++y) if (RowTable::SlideLeft(rows[y], &s) != rows[y]) return true;
+      return false;
+    case Right:
+      for(int y=0; y<H; ++y) if (RowTable::SlideRight(rows[y], &s) != rows[y]) return true;
+      return false;
+    case Up:
+      for(int x=0; x<W; ++x){
+        const Col c = GetCol(x);
+        if (ColTable::SlideLeft(c, &s) != c) return true;
+      }
+      return false;
+    case Down:
+      for(int x=0; x<W; ++x){
+        const Col c = GetCol(x);
+        if (ColTable::SlideRight(c, &s) != c) return true;
+      }
+      return false;
+    default:
+      return false;
+    }
+  }
+
+  int GetLegalMoves(Direction* moves) const
+  {
+    int n = 0;
+    for(int i=0; i<NumDirections; ++i)
+      if (CanSlide((Direction)i)) moves[n++] = (Direction)i;
+    return n;
+  }
+
+  bool IsDead() const
+  {
+    if (NumAvailableTiles() > 0) return false;
+    Direction moves[NumDirections];
+    return GetLegalMoves(moves) == 0;
+  }
+
+  void Print() const
+  {
+    for(int y=0; y<H; ++y){
+      for(int x=0; x<W; ++x){
+        const int v = GetCell(x, y);
+        if (v == 0) printf("          .");
+        else printf("% 11lld", 1LL << v);
+      }
+      printf("\n");
+    }
+  }
+
+  bool operator==(const BoardT& other) const
+  {
+    return memcmp(rows, other.rows, sizeof(rows)) == 0;
+  }
+
+  size_t Hash() const
+  {
+    uint64_t h = 0;
+    for(int y=0; y<H; ++y)
+      h = (h ^ rows[y]) * 0x9E3779B97F4A7C15ull;
+    return (size_t)(h ^ (h >> 29));
+  }
+
+  Row rows[H];
+  long long score;
+};
+
+typedef BoardT<3, 3, 4> Board3x3;
+typedef BoardT<5, 5, 4> Board5x5;
+typedef BoardT<4, 4, 5> BigTileBoard; // 4x4 with tiles up to 2^31
+
+namespace std {
+  template<int W, int H, int CellBits>
+  struct hash<BoardT<W, H, CellBits> >{
+    size_t operator()(const BoardT<W, H, CellBits>& b) const {
+      return b.Hash();
+    }
+  };
+}
+
+#endif
@@ -0,0 +1,163 @@
+#include <algorithm>
+#include "coro_search.h"
+#include "search_player_t.h"
+
+////////////////////////////////////////////////////////////
+// SearchTask
+
+SearchTask& SearchTask::operator=(SearchTask&& other)
+{
+	if (this != &other) {
+		if (handle) handle.destroy();
+		handle = other.handle;
+		other.handle = Handle();
+	}
+	return *this;
+}
+
+SearchTask::~SearchTask()
+{
+	if (handle) handle.destroy();
+}
+
+bool SearchTask::Resume()
+{
+	if (Done()) return false;
+	handle.resume();
+	return !handle.done();
+}
+
+////////////////////////////////////////////////////////////
+// CoSearch
+
+SearchTask CoSearch(Board board, int maxDepth, size_t quantum, SearchClock::time_point deadline)
+{
+	CoSearchResult result;
+	result.move = None;
+	result.depth = 0;
+	result.nodes = 0;
+
+	Board succ[NumDirections];
+	const int legal = board.GenerateMoves(succ);
+	if ((legal & (legal - 1)) == 0) {
+		for(int dir=0; dir<NumDirections; ++dir)
+			if (legal & (1 << dir)) result.move = (Direction)dir;
+		co_return result;
+	}
+
+	// The same search as SearchPlayerT<Board>, stepped here so that it can
+	// yield between nodes.
+	ExpectimaxT<Board> search;
+	size_t sinceYield = 0;
+	for(int depth=1; depth<=maxDepth; ++depth){
+		if (depth > 1 && SearchClock::now() >= deadline) break;
+		Direction best = None;
+		float bestValue = ExpectimaxT<Board>::DeadScore();
+		for(int dir=0; dir<NumDirections; ++dir){
+			if (!(legal & (1 << dir))) continue;
+			search.Start(succ[dir], depth - 1);
+			while(search.Step()){
+				if (++sinceYield >= quantum) {
+					sinceYield = 0;
+					result.nodes = search.nodes;
+					co_yield result;
+					if (result.depth > 0 && SearchClock::now() >= deadline) co_return result;
+				}
+			}
+			result.nodes = search.nodes;
+			if (best == None || search.Value() > bestValue) {
+				best = (Direction)dir;
+				bestValue = search.Value();
+			}
+		}
+		result.move = best;
+		result.depth = depth;
+	}
+	co_return result;
+}
+
+////////////////////////////////////////////////////////////
+// SearchScheduler
+
+SearchScheduler::SearchScheduler(int numThreads)
+	: maxDepth(4), quantum(2000), nPending(0), nextSeq(0), bQuit(false)
+{
+	if (numThreads <= 0) numThreads = std::max(1, (int)std::thread::hardware_concurrency());
+	for(int i=0; i<numThreads; ++i)
+		workers.push_back(std::thread(&SearchScheduler::WorkerLoop, this));
+}
+
+SearchScheduler::~SearchScheduler()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		bQuit = true;
+	}
+	wake.notify_all();
+	for(size_t i=0; i<workers.size(); ++i) workers[i].join();
+}
+
+bool SearchScheduler::LessUrgent(const std::unique_ptr<Job>& a, const std::unique_ptr<Job>& b)
+{
+	if (a->priority != b->priority) return a->priority < b->priority;
+	if (a->deadline != b->deadline) return a->deadline > b->deadline;
+	return a->seq > b->seq;
+}
+
+void SearchScheduler::Submit(const Board& board, int priority, double deadlineMS, const Callback& done)
+{
+	Direction moves[NumDirections];
+	if (board.GetLegalMoves(moves) <= 1) {
+		done(board.IsDead() ? None : moves[0]);
+		return;
+	}
+
+	std::unique_ptr<Job> job(new Job());
+	job->deadline = SearchClock::now()
+		+ std::chrono::duration_cast<SearchClock::duration>(std::chrono::duration<double, std::milli>(deadlineMS));
+	job->task = CoSearch(board, maxDepth, quantum, job->deadline);
+	job->priority = priority;
+	job->done = done;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		job->seq = nextSeq++;
+		queue.push_back(std::move(job));
+		std::push_heap(queue.begin(), queue.end(), LessUrgent);
+		++nPending;
+	}
+	wake.notify_one();
+}
+
+void SearchScheduler::WaitIdle()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	idle.wait(lock, [this]() { return nPending == 0; });
+}
+
+void SearchScheduler::WorkerLoop()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while(true){
+		wake.wait(lock, [this]() { return bQuit || !queue.empty(); });
+		if (bQuit) return;
+		std::pop_heap(queue.begin(), queue.end(), LessUrgent);
+		std::unique_ptr<Job> job = std::move(queue.back());
+		queue.pop_back();
+		lock.unlock();
+
+		if (job->task.Resume()) {
+			lock.lock();
+			job->seq = nextSeq++; // behind others of the same urgency
+			queue.push_back(std::move(job));
+			std::push_heap(queue.begin(), queue.end(), LessUrgent);
+			wake.notify_one();
+			continue;
+		}
+
+		// Called back without the lock, so it can submit the next search.
+		job->done(job->task.Result().move);
+		job.reset();
+		lock.lock();
+		if (--nPending == 0) idle.notify_all();
+	}
+}
@@ -0,0 +1,119 @@
+#ifndef __CORO_SEARCH_H__
+#define __CORO_SEARCH_H__
+
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "board.h"
+
+typedef std::chrono::steady_clock SearchClock;
+
+// Progress of a cooperative search.
+struct CoSearchResult
+{
+	Direction move; // best move of the deepest finished iteration
+	int depth;      // that iteration's depth in moves
+	size_t nodes;   // nodes expanded so far
+};
+
+// A search running as a coroutine.  Nothing runs until the first Resume;
+// each Resume runs until the search has expanded another quantum of nodes
+// or has finished.  Moves only, not copied.
+class SearchTask
+{
+public:
+	struct promise_type
+	{
+		CoSearchResult result;
+
+		SearchTask get_return_object() { return SearchTask(Handle::from_promise(*this)); }
+		std::suspend_always initial_suspend() noexcept { return std::suspend_always(); }
+		std::suspend_always final_suspend() noexcept { return std::suspend_always(); }
+		std::suspend_always yield_value(const CoSearchResult& r) { result = r; return std::suspend_always(); }
+		void return_value(const CoSearchResult& r) { result = r; }
+		void unhandled_exception() { throw; }
+	};
+	typedef std::coroutine_handle<promise_type> Handle;
+
+	SearchTask() {}
+	SearchTask(SearchTask&& other) : handle(other.handle) { other.handle = Handle(); }
+	SearchTask& operator=(SearchTask&& other);
+	~SearchTask();
+
+	// Returns true while the search is unfinished.
+	bool Resume();
+	bool Done() const { return !handle || handle.done(); }
+	const CoSearchResult& Result() const { return handle.promise().result; }
+
+private:
+	explicit SearchTask(Handle h) : handle(h) {}
+	SearchTask(const SearchTask&);
+	SearchTask& operator=(const SearchTask&);
+
+	Handle handle;
+};
+
+// SearchPlayerT's depth-first expectimax (ExpectimaxT<Board>), iteratively
+// deepened up to maxDepth moves, with each chance node cached per depth by
+// canonical board.  Yields every quantum expanded nodes; once deadline has passed it stops at the next
+// yield with the last finished iteration (depth 1 always finishes).  A
+// board with at most one legal move finishes on the first Resume without
+// searching.
+SearchTask CoSearch(Board board, int maxDepth, size_t quantum, SearchClock::time_point deadline);
+
+// Interleaves many cooperative searches on a few worker threads.  Each
+// worker takes the most urgent search, resumes it for one quantum and puts
+// it back, so a deep search never holds a thread for long.  Urgency is the
+// higher priority, then the earlier deadline, then the longest wait.
+// Boards with at most one legal move are answered on the submitting thread
+// and never queue.
+class SearchScheduler
+{
+public:
+	typedef std::function<void(Direction move)> Callback;
+
+	SearchScheduler(int numThreads = 0); // 0 = hardware concurrency
+	// Searches still queued are dropped without their callbacks.
+	~SearchScheduler();
+
+	// Searches board for up to deadlineMS and passes the move to done, which
+	// runs on a worker thread and may submit more searches.
+	void Submit(const Board& board, int priority, double deadlineMS, const Callback& done);
+
+	// Waits until every submitted search has called back.
+	void WaitIdle();
+
+	int NumThreads() const { return (int)workers.size(); }
+
+	int maxDepth;
+	size_t quantum;
+
+private:
+	struct Job
+	{
+		SearchTask task;
+		int priority;
+		SearchClock::time_point deadline;
+		unsigned long long seq; // when it was last queued
+		Callback done;
+	};
+	static bool LessUrgent(const std::unique_ptr<Job>& a, const std::unique_ptr<Job>& b);
+
+	void WorkerLoop();
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable idle;
+	std::vector<std::unique_ptr<Job> > queue; // heap, most urgent on top
+	size_t nPending; // submitted and not yet called back
+	unsigned long long nextSeq;
+	bool bQuit;
+};
+
+#endif
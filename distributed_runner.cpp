@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include "distributed_runner.h"
+#include "net.h"
+
+typedef std::chrono::steady_clock Clock;
+typedef std::pair<unsigned int, unsigned int> SeedRange;
+
+////////////////////////////////////////////////////////////
+// BatchCoordinator
+
+namespace {
+
+struct WorkerConn
+{
+	WorkerConn() : bBusy(false), bWantsWork(false), begin(0), end(0) {}
+
+	LineSocket sock;
+	bool bBusy;       // has a range
+	bool bWantsWork;  // sent READY and is waiting
+	unsigned int begin, end;
+	Clock::time_point lastHeard;
+};
+
+// Seeds of [begin, end) with no result yet, in order.
+void Unfinished(const SeedRanges& done, unsigned int begin, unsigned int end,
+	std::vector<SeedRange>* out)
+{
+	unsigned int s = begin;
+	while(s < end){
+		while(s < end && done.Contains(s)) ++s;
+		const unsigned int first = s;
+		while(s < end && !done.Contains(s)) ++s;
+		if (first < s) out->push_back(SeedRange(first, s));
+	}
+}
+
+}
+
+BatchCoordinator::BatchCoordinator(const std::string& resultsPath)
+	: chunkSize(10), workerTimeoutSec(600.0), bLocalOnly(true), runner(resultsPath)
+{
+}
+
+bool BatchCoordinator::Run(int port, unsigned int firstSeed, int numGames)
+{
+	LineSocket listener;
+	if (!LineSocket::Startup() || !listener.Listen(port, bLocalOnly)) {
+		printf("Can't listen on port %d\n", port);
+		return false;
+	}
+	if (!runner.Open()) return false;
+
+	std::deque<SeedRange> queue;
+	{
+		std::vector<SeedRange> todo;
+		Unfinished(runner.done, firstSeed, firstSeed + numGames, &todo);
+		queue.assign(todo.begin(), todo.end());
+	}
+	long long nLeft = 0;
+	for(size_t i=0; i<queue.size(); ++i) nLeft += queue[i].second - queue[i].first;
+	printf("Coordinator on port %d (%s): %lld games to play\n", port,
+		bLocalOnly ? "this machine only" : "all interfaces", nLeft);
+
+	std::vector<std::unique_ptr<WorkerConn> > workers;
+	int nBusy = 0;
+	int nConnected = 0;
+
+	// Puts the unreported part of a worker's range back in the queue.
+	auto release = [&](WorkerConn& w) {
+		if (!w.bBusy) return;
+		std::vector<SeedRange> left;
+		Unfinished(runner.done, w.begin, w.end, &left);
+		queue.insert(queue.begin(), left.begin(), left.end());
+		w.bBusy = false;
+		--nBusy;
+	};
+
+	while(!queue.empty() || nBusy > 0){
+		std::vector<LineSocket*> socks(1, &listener);
+		for(size_t i=0; i<workers.size(); ++i) socks.push_back(&workers[i]->sock);
+		std::vector<bool> ready;
+		LineSocket::Wait(&socks[0], socks.size(), 1000, &ready);
+		const Clock::time_point now = Clock::now();
+
+		if (ready[0]) {
+			std::unique_ptr<WorkerConn> w(new WorkerConn());
+			if (listener.Accept(&w->sock)) {
+				w->lastHeard = now;
+				workers.push_back(std::move(w));
+				printf("Worker %d connected\n", ++nConnected);
+			}
+		}
+
+		for(size_t i=1; i<ready.size(); ++i){
+			if (!ready[i]) continue;
+			WorkerConn& w = *workers[i-1];
+			std::vector<std::string> lines;
+			if (!w.sock.ReceiveLines(&lines)) {
+				w.sock.Close();
+			}
+			for(size_t j=0; j<lines.size(); ++j){
+				GameResult r;
+				if (lines[j] == "READY") {
+					release(w);
+					w.bWantsWork = true;
+				} else if (lines[j].compare(0, 7, "RESULT ") == 0
+					&& GameResult::Parse(lines[j].c_str() + 7, &r)) {
+					runner.Record(r);
+				} else {
+					printf("Bad message from worker: %s\n", lines[j].c_str());
+					w.sock.Close();
+					break;
+				}
+			}
+			w.lastHeard = now;
+		}
+
+		// Drop the dead and the silent; their seeds go to the others.
+		for(size_t i=0; i<workers.size(); ){
+			WorkerConn& w = *workers[i];
+			const double silentSec = std::chrono::duration<double>(now - w.lastHeard).count();
+			if (w.sock.IsOpen() && !(w.bBusy && silentSec > workerTimeoutSec)) {
+				++i;
+				continue;
+			}
+			if (w.bBusy) printf("Lost worker with seeds [%u, %u), reassigning\n", w.begin, w.end);
+			release(w);
+			workers.erase(workers.begin() + i);
+		}
+
+		for(size_t i=0; i<workers.size() && !queue.empty(); ++i){
+			WorkerConn& w = *workers[i];
+			if (!w.bWantsWork) continue;
+			SeedRange& next = queue.front();
+			w.begin = next.first;
+			w.end = std::min(next.second, next.first + chunkSize);
+			next.first = w.end;
+			if (next.first == next.second) queue.pop_front();
+
+			char msg[64];
+			snprintf(msg, sizeof(msg), "RANGE %u %u", w.begin, w.end);
+			w.bBusy = true;
+			w.bWantsWork = false;
+			w.lastHeard = now;
+			++nBusy;
+			if (!w.sock.SendLine(msg)) w.sock.Close(); // dropped next time round
+		}
+	}
+
+	for(size_t i=0; i<workers.size(); ++i) workers[i]->sock.SendLine("DONE");
+	runner.Close();
+	return true;
+}
+
+////////////////////////////////////////////////////////////
+// BatchWorker
+
+BatchWorker::BatchWorker(Player* player_) : player(player_)
+{
+}
+
+bool BatchWorker::Run(const char* host, int port)
+{
+	LineSocket sock;
+	if (!LineSocket::Startup() || !sock.Connect(host, port)) {
+		printf("Can't connect to %s:%d\n", host, port);
+		return false;
+	}
+
+	int nGames = 0;
+	std::string line;
+	while(sock.SendLine("READY") && sock.ReadLine(&line)){
+		unsigned int begin, end;
+		if (line == "DONE") {
+			printf("Worker done after %d games\n", nGames);
+			return true;
+		}
+		if (sscanf(line.c_str(), "RANGE %u %u", &begin, &end) != 2) break;
+		for(unsigned int seed=begin; seed<end; ++seed){
+			const GameResult r = BatchRunner::PlayGame(player, seed);
+			if (!sock.SendLine("RESULT " + r.Format())) return false;
+			++nGames;
+		}
+	}
+	return false;
+}
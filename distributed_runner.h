@@ -0,0 +1,54 @@
+#ifndef __DISTRIBUTED_RUNNER_H__
+#define __DISTRIBUTED_RUNNER_H__
+
+#include <string>
+#include "batch_runner.h"
+#include "player.h"
+
+// Runs a batch across worker processes connected over TCP.
+//
+// The coordinator owns the results file and checkpoint, exactly as a
+// BatchRunner does, so a coordinator restarted on the same file resumes.
+// It hands each worker a range of chunkSize seeds and takes back one result
+// line per game as it finishes.  A worker whose connection drops, or that
+// says nothing for workerTimeoutSec, is dropped and the seeds of its range
+// not yet reported go back to the front of the queue for the next worker
+// that asks.  Workers can join at any time.
+//
+// Protocol, one line per message:
+//   worker -> coordinator: "READY" (wants a range), "RESULT <result line>"
+//   coordinator -> worker: "RANGE <begin> <end>", "DONE"
+// The protocol has no authentication or encryption: anything that can
+// reach the port can take ranges and write results into the file.  By
+// default (bLocalOnly) the coordinator listens on the loopback interface
+// only; listen on all interfaces only on a trusted network.
+class BatchCoordinator
+{
+public:
+	BatchCoordinator(const std::string& resultsPath);
+
+	// Returns when every seed in [firstSeed, firstSeed + numGames) has a
+	// result, or false if the results file or port can't be opened.
+	bool Run(int port, unsigned int firstSeed, int numGames);
+
+	unsigned int chunkSize;
+	double workerTimeoutSec;
+	bool bLocalOnly; // accept workers from this machine only (the default)
+
+	BatchRunner runner;
+};
+
+// Connects to a coordinator and plays the ranges it hands out until it says
+// DONE.  Returns false if the connection fails or drops first.
+class BatchWorker
+{
+public:
+	BatchWorker(Player* player);
+
+	bool Run(const char* host, int port);
+
+private:
+	Player* player;
+};
+
+#endif
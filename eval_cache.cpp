@@ -0,0 +1,77 @@
+#include <algorithm>
+#include "batch_eval.h"
+#include "eval_cache.h"
+#include "trace.h"
+
+EvalCache::EvalCache() : hits(0), misses(0), mask(0) {}
+
+void EvalCache::Resize(size_t numEntries)
+{
+	size_t size = 0;
+	if (numEntries > 0) {
+		size = 1;
+		while(size <= numEntries / 2 && size < ((size_t)1 << 32)) size *= 2;
+	}
+	mask = (size > 0 ? size - 1 : 0);
+	Entry empty = { 0, 0.0f, 0 };
+	entries.assign(size, empty);
+}
+
+void EvalCache::Eval(const uint64_t* boards, const int* gameScores, size_t n,
+	float* out, byte* dead)
+{
+	if (entries.empty()) {
+		TRACE_COUNT("BatchEval", n);
+		misses += n;
+		BatchEval::Eval(boards, gameScores, n, out, dead);
+		return;
+	}
+
+	const size_t BatchSize = 256;
+	float value[BatchSize], missValue[BatchSize];
+	byte bDead[BatchSize], missDead[BatchSize];
+	uint64_t missBoard[BatchSize];
+	size_t missIx[BatchSize];
+	for(size_t i=0; i<n; i+=BatchSize){
+		const size_t m = std::min(BatchSize, n - i);
+
+		size_t nMiss = 0;
+		for(size_t j=0; j<m; ++j){
+			const Entry& e = entries[Slot(boards[i+j])];
+			if (e.board == boards[i+j]) {
+				value[j] = e.value;
+				bDead[j] = (byte)e.bDead;
+			} else {
+				missIx[nMiss] = j;
+				missBoard[nMiss++] = boards[i+j];
+			}
+		}
+		hits += m - nMiss;
+		misses += nMiss;
+		TRACE_COUNT("EvalCache.hits", m - nMiss);
+		TRACE_COUNT("BatchEval", nMiss);
+
+		BatchEval::Eval(missBoard, nullptr, nMiss, missValue, missDead);
+		for(size_t k=0; k<nMiss; ++k){
+			const size_t j = missIx[k];
+			value[j] = missValue[k];
+			bDead[j] = missDead[k];
+			Entry& e = entries[Slot(missBoard[k])];
+			e.board = missBoard[k];
+			e.value = missValue[k];
+			e.bDead = missDead[k];
+		}
+
+		// Add back the game score term, four at a time.
+		for(size_t j=0; j<m; j+=4){
+			float score[4], logScore[4];
+			for(size_t k=0; k<4; ++k)
+				score[k] = (j+k < m ? (float)gameScores[i+j+k] : 1.0f);
+			BatchEval::Log4(score, logScore);
+			for(size_t k=0; k<4 && j+k<m; ++k)
+				out[i+j+k] = value[j+k] + 0.2f*logScore[k];
+		}
+		if (dead != nullptr)
+			std::copy(bDead, bDead + m, dead + i);
+	}
+}
@@ -0,0 +1,48 @@
+#ifndef __EVAL_CACHE_H__
+#define __EVAL_CACHE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "board.h"
+
+// Direct-mapped cache of leaf evaluations keyed by the 64-bit board.
+// Entries hold the part of the evaluation that depends only on the board
+// (everything but the game score term) and whether the board is dead, so
+// a hit is good for any game score.  A new entry overwrites whatever was in
+// its slot.  Not thread-safe: each search thread owns one.
+class EvalCache
+{
+public:
+	EvalCache();
+
+	// Number of entries, rounded down to a power of two; 0 disables the cache.
+	void Resize(size_t numEntries);
+	size_t Size() const { return entries.size(); }
+	size_t Bytes() const { return entries.size() * sizeof(Entry); }
+
+	// Same results as BatchEval::Eval, with hits served from the cache and
+	// the misses evaluated in one batch and stored.
+	void Eval(const uint64_t* boards, const int* gameScores, size_t n,
+		float* out, byte* dead = nullptr);
+
+	void ResetCounts() { hits = misses = 0; }
+
+	size_t hits;
+	size_t misses;
+
+private:
+	struct Entry
+	{
+		uint64_t board; // 0 = empty slot; an empty board is never a leaf
+		float value;
+		uint32_t bDead;
+	};
+
+	size_t Slot(uint64_t b) const { return (size_t)((b * 0x9E3779B97F4A7C15ull) >> 32) & mask; }
+
+	std::vector<Entry> entries;
+	size_t mask;
+};
+
+#endif
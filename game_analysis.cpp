@@ -0,0 +1,164 @@
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include "game_analysis.h"
+#include "rng.h"
+#include "search_player.h"
+#include "thread_pool.h"
+
+////////////////////////////////////////////////////////////
+// AnalysisStats
+
+AnalysisStats::AnalysisStats()
+	: nGames(0), nBadGames(0), nMoves(0), nSearched(0), nFlagged(0), sumLoss(0.0), ms(0.0)
+{
+}
+
+void AnalysisStats::Print() const
+{
+	printf("Games: %lld (%lld bad)  moves: %lld, %lld searched, %lld flagged  mean loss %.4f  %.1fs\n",
+		nGames, nBadGames, nMoves, nSearched, nFlagged, sumLoss / std::max(nSearched, 1LL), ms / 1000.0);
+}
+
+////////////////////////////////////////////////////////////
+// GameAnalyzer
+
+// Reads a line of any length, without its newline.
+static bool ReadLine(FILE* f, std::string* line)
+{
+	line->clear();
+	char buf[4096];
+	while(fgets(buf, sizeof(buf), f) != NULL){
+		const size_t len = strlen(buf);
+		if (len > 0 && buf[len-1] == '\n') {
+			line->append(buf, len - 1);
+			return true;
+		}
+		line->append(buf, len);
+	}
+	return !line->empty();
+}
+
+GameAnalyzer::GameAnalyzer()
+	: msPerPosition(1000.0), maxDepth(0), numThreads(0), memoryMB(4096), flagLoss(0.1f),
+	  batchPositions(1024)
+{
+}
+
+void GameAnalyzer::Run(FILE* in, FILE* out)
+{
+	typedef std::chrono::steady_clock Clock;
+	ThreadPool pool(numThreads);
+	SearchPlayerSet players(pool.NumThreads(), memoryMB);
+	players.SetBudget(maxDepth > 0 ? 1e9 : msPerPosition, maxDepth, true);
+
+	stats = AnalysisStats();
+	games.clear();
+	const Clock::time_point start = Clock::now();
+
+	// The game being replayed, which may span batches.
+	GameRecord record;
+	Board board;
+	RNG rng;
+	size_t ply = 0;
+	bool bReplaying = false;
+
+	std::string line;
+	bool bEnd = false;
+	while(!bEnd){
+		batch.clear();
+		while(batch.size() < std::max(batchPositions, (size_t)1)){
+			if (!bReplaying) {
+				if (!ReadLine(in, &line)) {
+					bEnd = true;
+					break;
+				}
+				if (!GameRecord::Parse(line.c_str(), &record)) continue;
+				Game g = { record.seed, 0, 0, -1, 0, 0, 0.0, 0.0f };
+				games.push_back(g);
+				rng = RNG(record.seed);
+				board.Reset();
+				board.AddRandomTile(rng);
+				board.AddRandomTile(rng);
+				ply = 0;
+				bReplaying = true;
+			}
+
+			Game& g = games.back();
+			g.nMoves = (int)ply;
+			g.score = board.Score();
+			if (ply == record.moves.size()) {
+				bReplaying = false;
+				continue;
+			}
+			const Direction move = (Direction)(strchr(GameRecord::MoveChars, record.moves[ply]) - GameRecord::MoveChars);
+			Direction moves[NumDirections];
+			const int nLegal = board.GetLegalMoves(moves);
+			if (!board.CanSlide(move)) {
+				g.badPly = (int)ply;
+				bReplaying = false;
+				continue;
+			}
+			if (nLegal > 1) {
+				Position pos = { board, games.size() - 1, (int)ply, move, None, 0.0f };
+				batch.push_back(pos);
+			}
+			board.Slide(move);
+			board.AddRandomTile(rng);
+			++ply;
+		}
+
+		pool.ParallelFor(batch.size(), 1, [&](size_t begin, size_t end, int iThread) {
+			SearchPlayer& player = players[iThread];
+			for(size_t i=begin; i<end; ++i){
+				Position& pos = batch[i];
+				pos.best = player.FindBestMove(pos.board);
+				const float* score = player.stats.rootScore;
+				pos.loss = 0.0f;
+				if (pos.best != None && !isinf(score[pos.played]))
+					pos.loss = std::max(0.0f, score[pos.best] - score[pos.played]);
+			}
+		});
+
+		Emit(out, bReplaying ? games.size() - 1 : games.size());
+	}
+	stats.ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Writes the batch's moves, then the first numDone games, which have no
+// moves left to search.
+void GameAnalyzer::Emit(FILE* out, size_t numDone)
+{
+	for(size_t i=0; i<batch.size(); ++i){
+		const Position& pos = batch[i];
+		Game& g = games[pos.game];
+		const bool bFlagged = pos.loss > flagLoss;
+		fprintf(out, "move %u %d %016llx %c %c %.4f%s\n", g.seed, pos.ply,
+			(unsigned long long)pos.board.Bits(), GameRecord::MoveChars[pos.played],
+			pos.best == None ? '-' : GameRecord::MoveChars[pos.best], pos.loss, bFlagged ? " *" : "");
+		++g.nSearched;
+		g.nFlagged += bFlagged;
+		g.sumLoss += pos.loss;
+		g.maxLoss = std::max(g.maxLoss, pos.loss);
+	}
+
+	for(size_t i=0; i<numDone; ++i){
+		const Game& g = games[i];
+		if (g.badPly >= 0) {
+			fprintf(out, "game %u bad %d\n", g.seed, g.badPly);
+			++stats.nBadGames;
+		} else {
+			fprintf(out, "game %u %d %d %d %d %.4f %.4f\n", g.seed, g.nMoves, g.score, g.nSearched,
+				g.nFlagged, g.sumLoss, g.maxLoss);
+		}
+		++stats.nGames;
+		stats.nMoves += g.nMoves;
+		stats.nSearched += g.nSearched;
+		stats.nFlagged += g.nFlagged;
+		stats.sumLoss += g.sumLoss;
+	}
+	games.erase(games.begin(), games.begin() + numDone);
+	fflush(out);
+}
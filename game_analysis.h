@@ -0,0 +1,82 @@
+#ifndef __GAME_ANALYSIS_H__
+#define __GAME_ANALYSIS_H__
+
+#include <stddef.h>
+#include <stdio.h>
+#include <vector>
+#include "batch_runner.h"
+#include "board.h"
+
+// Totals over the games analyzed so far.
+struct AnalysisStats
+{
+	AnalysisStats();
+	void Print() const;
+
+	long long nGames;
+	long long nBadGames;  // records that don't replay
+	long long nMoves;
+	long long nSearched;  // moves with a choice
+	long long nFlagged;
+	double sumLoss;
+	double ms;            // wall time
+};
+
+// Grades recorded games: replays each GameRecord, searches every position
+// that had a choice with a budget of its own, and charges the move played
+// with the shortfall of its backed-up score from the best move's.  Moves
+// losing more than flagLoss are flagged.  Records are read and positions
+// searched batchPositions at a time, spread over numThreads threads with a
+// search player each, so memory stays flat however long the input is.  Each
+// position gets a fixed msPerPosition of wall time however many threads
+// search at once.
+//
+// Output, in input order:
+//   move <seed> <ply> <board hex> <played> <best> <loss> [*]   (* = flagged)
+//   game <seed> <moves> <score> <searched> <flagged> <total loss> <max loss>
+//   game <seed> bad <ply>   if the record has an illegal move at ply
+// Records that don't parse are skipped.
+class GameAnalyzer
+{
+public:
+	GameAnalyzer();
+
+	void Run(FILE* in, FILE* out);
+
+	double msPerPosition;  // wall time
+	int maxDepth;          // 0 = no limit
+	int numThreads;        // 0 = one per core
+	size_t memoryMB;       // shared by all threads
+	float flagLoss;
+	size_t batchPositions;
+	AnalysisStats stats;
+
+private:
+	struct Position
+	{
+		Board board;
+		size_t game;       // index into games
+		int ply;
+		Direction played;
+		Direction best;
+		float loss;
+	};
+	struct Game
+	{
+		unsigned int seed;
+		int nMoves;
+		int score;
+		int badPly;        // -1 if the record replays
+		int nSearched;
+		int nFlagged;
+		double sumLoss;
+		float maxLoss;
+	};
+
+	void Emit(FILE* out, size_t numDone);
+
+	std::vector<Position> batch;
+	std::vector<Game> games; // not yet written out; the last may be in progress
+};
+
+#endif
@@ -0,0 +1,234 @@
+#ifdef _WIN32
+#  include <windows.h>
+#  include <psapi.h>
+#  pragma comment(lib, "psapi.lib")
+#else
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+#include "large_pages.h"
+#include "thread_pool.h"
+
+static const size_t HugePageBytes = 2 << 20; // x86-64; Windows asks the OS
+static const size_t TouchBytes = 4096;       // the smallest page size
+
+PageStats pageStats;
+
+static std::atomic<int> pageMode(NormalPages);
+
+// Blocks mapped from the OS, for freeing them and keeping the counters.
+struct Block
+{
+	size_t length; // as mapped
+	bool bHuge;
+};
+static std::mutex blocksMutex;
+static std::unordered_map<void*, Block> blocks;
+
+void SetPageMode(PageMode mode)
+{
+	pageMode = mode;
+}
+
+PageMode GetPageMode()
+{
+	return (PageMode)pageMode.load();
+}
+
+bool ParsePageMode(const char* name, PageMode* mode)
+{
+	static const char* Names[3] = { "normal", "transparent", "explicit" };
+	for(int i=0; i<3; ++i){
+		if (strcmp(name, Names[i]) == 0) {
+			*mode = (PageMode)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+#ifdef _WIN32
+
+// Large pages need SeLockMemoryPrivilege, which the account must hold and
+// the process must enable; try once.
+static bool EnableLockMemory()
+{
+	HANDLE token;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) return false;
+	TOKEN_PRIVILEGES tp;
+	tp.PrivilegeCount = 1;
+	tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	const bool bOK = LookupPrivilegeValueA(NULL, "SeLockMemoryPrivilege", &tp.Privileges[0].Luid)
+		&& AdjustTokenPrivileges(token, FALSE, &tp, 0, NULL, NULL) && GetLastError() == ERROR_SUCCESS;
+	CloseHandle(token);
+	return bOK;
+}
+
+static void* MapBlock(size_t bytes, PageMode mode, Block* block)
+{
+	if (mode == ExplicitPages) {
+		static const bool bLockMemory = EnableLockMemory();
+		const size_t large = GetLargePageMinimum();
+		if (bLockMemory && large > 0) {
+			block->length = (bytes + large - 1) / large * large;
+			void* p = VirtualAlloc(NULL, block->length, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+			if (p != NULL) {
+				block->bHuge = true;
+				return p;
+			}
+		}
+		++pageStats.fallbacks;
+	}
+	// Windows has no transparent huge pages.
+	block->length = bytes;
+	block->bHuge = false;
+	return VirtualAlloc(NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+static void UnmapBlock(void* p, const Block&)
+{
+	VirtualFree(p, 0, MEM_RELEASE);
+}
+
+#else
+
+static void* MapBlock(size_t bytes, PageMode mode, Block* block)
+{
+	block->length = (bytes + HugePageBytes - 1) / HugePageBytes * HugePageBytes;
+	block->bHuge = false;
+#ifdef MAP_HUGETLB
+	if (mode == ExplicitPages) {
+		void* p = mmap(NULL, block->length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED) {
+			block->bHuge = true;
+			return p;
+		}
+		++pageStats.fallbacks; // none reserved; try transparent ones
+	}
+#endif
+
+	// Over-map and trim so the block starts on a huge page boundary, where
+	// the kernel can back it with huge pages.
+	const size_t mapped = block->length + HugePageBytes;
+	char* raw = (char*)mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (raw == (char*)MAP_FAILED) return NULL;
+	char* p = (char*)(((uintptr_t)raw + HugePageBytes - 1) & ~(uintptr_t)(HugePageBytes - 1));
+	if (p > raw) munmap(raw, p - raw);
+	if (raw + mapped > p + block->length) munmap(p + block->length, raw + mapped - (p + block->length));
+
+	if (mode != NormalPages) {
+#ifdef MADV_HUGEPAGE
+		block->bHuge = (madvise(p, block->length, MADV_HUGEPAGE) == 0);
+#endif
+		if (!block->bHuge) ++pageStats.fallbacks;
+	}
+	return p;
+}
+
+static void UnmapBlock(void* p, const Block& block)
+{
+	munmap(p, block.length);
+}
+
+#endif
+
+void* AllocPages(size_t bytes)
+{
+	if (bytes < LargeBlockBytes) return ::operator new(bytes, std::nothrow);
+
+	Block block;
+	void* p = MapBlock(bytes, GetPageMode(), &block);
+	if (p == NULL) return nullptr;
+	{
+		std::lock_guard<std::mutex> lock(blocksMutex);
+		blocks[p] = block;
+	}
+	pageStats.bytes += block.length;
+	if (block.bHuge) pageStats.hugeBytes += block.length;
+	++pageStats.blocks;
+	return p;
+}
+
+void FreePages(void* p, size_t bytes)
+{
+	if (p == nullptr) return;
+	if (bytes < LargeBlockBytes) {
+		::operator delete(p);
+		return;
+	}
+
+	Block block;
+	{
+		std::lock_guard<std::mutex> lock(blocksMutex);
+		std::unordered_map<void*, Block>::iterator it = blocks.find(p);
+		if (it == blocks.end()) return;
+		block = it->second;
+		blocks.erase(it);
+	}
+	pageStats.bytes -= block.length;
+	if (block.bHuge) pageStats.hugeBytes -= block.length;
+	--pageStats.blocks;
+	UnmapBlock(p, block);
+}
+
+void FirstTouch(ThreadPool* pool, void* begin, void* end)
+{
+	volatile char* first = (volatile char*)(((uintptr_t)begin + TouchBytes - 1) & ~(uintptr_t)(TouchBytes - 1));
+	if ((void*)first >= end) return;
+	const size_t nPages = ((char*)end - (char*)first + TouchBytes - 1) / TouchBytes;
+	pool->ParallelFor(nPages, 256, [first](size_t b, size_t e, int) {
+		// A read then a write of the same byte, so this is harmless on pages
+		// already in use.
+		for(size_t i=b; i<e; ++i) first[i * TouchBytes] = first[i * TouchBytes];
+	});
+}
+
+bool PagesByNode(const void* p, size_t bytes, std::vector<size_t>* counts, size_t maxSamples)
+{
+	counts->clear();
+	const size_t nPages = (bytes + TouchBytes - 1) / TouchBytes;
+	if (nPages == 0) return true;
+	const size_t step = std::max((size_t)1, nPages / std::max(maxSamples, (size_t)1));
+	std::vector<void*> pages;
+	for(size_t i=0; i<nPages; i+=step)
+		pages.push_back((char*)p + i * TouchBytes);
+
+#ifdef _WIN32
+	std::vector<PSAPI_WORKING_SET_EX_INFORMATION> info(pages.size());
+	for(size_t i=0; i<pages.size(); ++i) info[i].VirtualAddress = pages[i];
+	if (!QueryWorkingSetEx(GetCurrentProcess(), &info[0], (DWORD)(info.size() * sizeof(info[0])))) return false;
+	for(size_t i=0; i<info.size(); ++i){
+		if (!info[i].VirtualAttributes.Valid) continue;
+		const size_t node = info[i].VirtualAttributes.Node;
+		if (node >= counts->size()) counts->resize(node + 1, 0);
+		++(*counts)[node];
+	}
+	return true;
+#elif defined(SYS_move_pages)
+	// move_pages with no target nodes only reports where each page is.
+	std::vector<int> status(pages.size());
+	if (syscall(SYS_move_pages, 0, pages.size(), &pages[0], NULL, &status[0], 0) != 0) return false;
+	for(size_t i=0; i<status.size(); ++i){
+		if (status[i] < 0) continue; // not resident
+		if ((size_t)status[i] >= counts->size()) counts->resize(status[i] + 1, 0);
+		++(*counts)[status[i]];
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+void PrintPageStats()
+{
+	printf("Pages: %.1fMB in %lu blocks, %.1fMB huge, %lu refused\n",
+		pageStats.bytes / (1024.0 * 1024.0), (unsigned long)pageStats.blocks.load(),
+		pageStats.hugeBytes / (1024.0 * 1024.0), (unsigned long)pageStats.fallbacks.load());
+}
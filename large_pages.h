@@ -0,0 +1,78 @@
+#ifndef __LARGE_PAGES_H__
+#define __LARGE_PAGES_H__
+
+#include <stddef.h>
+#include <atomic>
+#include <new>
+#include <vector>
+
+class ThreadPool;
+
+// Memory for the big search structures (plies, dedup tables).  Blocks of
+// at least LargeBlockBytes are mapped straight from the OS so they can be
+// backed by huge pages, cutting TLB misses on trees of gigabytes:
+//   NormalPages       plain pages (the default)
+//   TransparentPages  ask for transparent huge pages (Linux madvise)
+//   ExplicitPages     reserved huge pages (Linux MAP_HUGETLB, Windows
+//                     MEM_LARGE_PAGES), falling back to transparent ones
+// Whatever the OS refuses falls back to plain pages, so every mode works
+// everywhere; the counters say what was actually granted.  Smaller blocks
+// come from operator new.
+enum PageMode { NormalPages, TransparentPages, ExplicitPages };
+
+static const size_t LargeBlockBytes = 1 << 20;
+
+void SetPageMode(PageMode mode); // for blocks allocated from now on
+PageMode GetPageMode();
+bool ParsePageMode(const char* name, PageMode* mode); // normal, transparent, explicit
+
+void* AllocPages(size_t bytes);
+void FreePages(void* p, size_t bytes);
+
+// Faults in the pages of [begin, end) across the pool, so on a NUMA machine
+// each page lands on the node of the worker that touched it instead of all
+// on the caller's.  Only worth it for memory not yet written.
+void FirstTouch(ThreadPool* pool, void* begin, void* end);
+
+// Counts the resident pages of [p, p + bytes) on each NUMA node, sampling
+// at most maxSamples pages; counts[i] is for node i.  Returns false if the
+// OS can't say.
+bool PagesByNode(const void* p, size_t bytes, std::vector<size_t>* counts, size_t maxSamples = 4096);
+
+// Totals over blocks mapped from the OS and still live.
+struct PageStats
+{
+	std::atomic<size_t> bytes;       // all mapped blocks
+	std::atomic<size_t> hugeBytes;   // those granted huge pages
+	std::atomic<size_t> blocks;
+	std::atomic<size_t> fallbacks;   // huge pages asked for but refused (cumulative)
+};
+extern PageStats pageStats;
+void PrintPageStats();
+
+// Allocator for std::vector that takes its memory from AllocPages.
+template<class T>
+class PageAllocator
+{
+public:
+	typedef T value_type;
+
+	PageAllocator() {}
+	template<class U> PageAllocator(const PageAllocator<U>&) {}
+
+	T* allocate(size_t n)
+	{
+		void* p = AllocPages(n * sizeof(T));
+		if (p == nullptr) throw std::bad_alloc();
+		return static_cast<T*>(p);
+	}
+	void deallocate(T* p, size_t n) { FreePages(p, n * sizeof(T)); }
+
+	template<class U> struct rebind { typedef PageAllocator<U> other; };
+	template<class U> bool operator==(const PageAllocator<U>&) const { return true; }
+	template<class U> bool operator!=(const PageAllocator<U>&) const { return false; }
+};
+
+template<class T> using PageVector = std::vector<T, PageAllocator<T> >;
+
+#endif
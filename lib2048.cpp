@@ -0,0 +1,180 @@
+#define LIB2048_EXPORTS
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "batch_eval.h"
+#include "board.h"
+#include "lib2048.h"
+#include "search_player.h"
+#include "thread_pool.h"
+
+struct g2048_pool
+{
+	// Parallel searches get a player per thread with backup run inline;
+	// a lone board gets a player that runs backup on the whole pool.
+	g2048_pool(int numThreads, size_t memoryMB) : pool(numThreads), players(pool.NumThreads(), memoryMB)
+	{
+		poolPlayer.reset(new SearchPlayer(&pool));
+		poolPlayer->SetMemoryBudget(memoryMB);
+		poolPlayer->bVerbose = false;
+	}
+
+	ThreadPool pool;
+	SearchPlayerSet players;
+	std::unique_ptr<SearchPlayer> poolPlayer;
+};
+
+static const size_t BatchGrain = 4096;
+
+// Runs fn over [0, n) on the pool if there is one, else inline.
+template<class Fn>
+static void ForRange(g2048_pool* pool, size_t n, size_t grain, const Fn& fn)
+{
+	if (pool == NULL) {
+		fn(0, n, 0);
+		return;
+	}
+	const Fn* f = &fn; // one pointer fits std::function's small buffer
+	pool->pool.ParallelFor(n, grain, [f](size_t begin, size_t end, int iThread) {
+		(*f)(begin, end, iThread);
+	});
+}
+
+static Board ToBoard(uint64_t b, int32_t score = 0)
+{
+	Board board;
+	board.SetBits(b);
+	board.score = score;
+	return board;
+}
+
+extern "C" {
+
+int g2048_version(void)
+{
+	return G2048_VERSION;
+}
+
+void g2048_init(void)
+{
+	static std::once_flag once;
+	std::call_once(once, []() { Board::Init(); });
+}
+
+int g2048_legal_moves(uint64_t board)
+{
+	return ToBoard(board).LegalMoveMask();
+}
+
+int g2048_slide(uint64_t board, int dir, uint64_t* out, int32_t* gain)
+{
+	if (dir < 0 || dir >= NumDirections) return 0;
+	Board b = ToBoard(board);
+	const bool bMoved = b.Slide((Direction)dir);
+	if (out != NULL) *out = b.Bits();
+	if (gain != NULL) *gain = b.score;
+	return bMoved ? 1 : 0;
+}
+
+int g2048_is_dead(uint64_t board)
+{
+	return ToBoard(board).IsDead() ? 1 : 0;
+}
+
+int g2048_max_tile(uint64_t board)
+{
+	return ToBoard(board).MaxTile();
+}
+
+int g2048_empty_cells(uint64_t board)
+{
+	return ToBoard(board).NumAvailableTiles();
+}
+
+uint64_t g2048_canonical(uint64_t board)
+{
+	return ToBoard(board).GetCanonical().Bits();
+}
+
+float g2048_eval(uint64_t board, int32_t score)
+{
+	return SearchPlayer::Eval(ToBoard(board, score));
+}
+
+g2048_pool* g2048_pool_create(int numThreads, size_t memoryMB)
+{
+	g2048_init();
+	return new g2048_pool(numThreads, memoryMB);
+}
+
+void g2048_pool_destroy(g2048_pool* pool)
+{
+	delete pool;
+}
+
+int g2048_pool_threads(const g2048_pool* pool)
+{
+	return pool != NULL ? pool->pool.NumThreads() : 1;
+}
+
+int g2048_slide_batch(g2048_pool* pool, const uint64_t* boards, size_t n,
+	uint64_t* succ, int32_t* gains, uint8_t* masks)
+{
+	if (n > 0 && (boards == NULL || succ == NULL)) return G2048_ERR_ARG;
+	ForRange(pool, n, BatchGrain, [=](size_t begin, size_t end, int) {
+		int g[NumDirections];
+		for(size_t i=begin; i<end; ++i){
+			const int mask = Board::GenerateMoves(boards[i], &succ[NumDirections*i], g);
+			if (gains != NULL)
+				for(int d=0; d<NumDirections; ++d) gains[NumDirections*i + d] = g[d];
+			if (masks != NULL) masks[i] = (uint8_t)mask;
+		}
+	});
+	return G2048_OK;
+}
+
+int g2048_legal_moves_batch(g2048_pool* pool, const uint64_t* boards, size_t n, uint8_t* masks)
+{
+	if (n > 0 && (boards == NULL || masks == NULL)) return G2048_ERR_ARG;
+	ForRange(pool, n, BatchGrain, [=](size_t begin, size_t end, int) {
+		for(size_t i=begin; i<end; ++i)
+			masks[i] = (uint8_t)ToBoard(boards[i]).LegalMoveMask();
+	});
+	return G2048_OK;
+}
+
+int g2048_eval_batch(g2048_pool* pool, const uint64_t* boards, const int32_t* scores,
+	size_t n, float* out)
+{
+	if (n > 0 && (boards == NULL || scores == NULL || out == NULL)) return G2048_ERR_ARG;
+	ForRange(pool, n, BatchGrain, [=](size_t begin, size_t end, int) {
+		BatchEval::Eval(boards + begin, scores + begin, end - begin, out + begin);
+	});
+	return G2048_OK;
+}
+
+int g2048_search_batch(g2048_pool* pool, const uint64_t* boards, const int32_t* scores,
+	size_t n, double msPerBoard, int maxDepth, int8_t* moves)
+{
+	if (pool == NULL || (n > 0 && (boards == NULL || scores == NULL || moves == NULL)))
+		return G2048_ERR_ARG;
+
+	if (n == 1) {
+		SearchPlayer& player = *pool->poolPlayer;
+		player.timeManager.baseMS = msPerBoard;
+		player.maxMoveDepth = (maxDepth > 0 ? maxDepth : 99);
+		moves[0] = (int8_t)player.FindBestMove(ToBoard(boards[0], scores[0]));
+		return G2048_OK;
+	}
+
+	pool->players.SetBudget(msPerBoard, maxDepth);
+	ForRange(pool, n, 1, [=](size_t begin, size_t end, int iThread) {
+		SearchPlayer& player = pool->players[iThread];
+		for(size_t i=begin; i<end; ++i)
+			moves[i] = (int8_t)player.FindBestMove(ToBoard(boards[i], scores[i]));
+	});
+	return G2048_OK;
+}
+
+}
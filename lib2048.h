@@ -0,0 +1,88 @@
+#ifndef __LIB2048_H__
+#define __LIB2048_H__
+
+/* C interface to the 2048 engine, for building as a shared library
+ * (lib2048.cpp plus everything but Game2048.cpp).
+ *
+ * Boards are 64-bit words, 4 bits per cell holding log2 of the tile (0 =
+ * empty), cell i = row i/4, column i%4 at bits 4*i.  Directions are
+ * 0 = left, 1 = right, 2 = up, 3 = down; -1 means no move.
+ *
+ * Batch calls work on arrays owned by the caller and allocate nothing.
+ * They take an optional pool handle; with one the work is split across its
+ * threads, without one it runs on the calling thread.  A pool must be used
+ * by one calling thread at a time.  Call g2048_init once before anything
+ * else. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#  ifdef LIB2048_EXPORTS
+#    define LIB2048_API __declspec(dllexport)
+#  else
+#    define LIB2048_API __declspec(dllimport)
+#  endif
+#else
+#  define LIB2048_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define G2048_VERSION 1
+
+#define G2048_OK 0
+#define G2048_ERR_ARG -1
+
+typedef struct g2048_pool g2048_pool;
+
+LIB2048_API int g2048_version(void);
+LIB2048_API void g2048_init(void);
+
+/* Single boards. */
+LIB2048_API int g2048_legal_moves(uint64_t board); /* bit d set if move d is legal */
+LIB2048_API int g2048_slide(uint64_t board, int dir, uint64_t* out, int32_t* gain); /* 1 if it moved */
+LIB2048_API int g2048_is_dead(uint64_t board);
+LIB2048_API int g2048_max_tile(uint64_t board); /* log2 */
+LIB2048_API int g2048_empty_cells(uint64_t board);
+LIB2048_API uint64_t g2048_canonical(uint64_t board);
+LIB2048_API float g2048_eval(uint64_t board, int32_t score);
+
+/* Thread pool plus search players, kept across calls so their buffers are
+ * reused.  numThreads 0 = one per core.  memoryMB is the budget of a
+ * single-board search; parallel searches split it between threads. */
+LIB2048_API g2048_pool* g2048_pool_create(int numThreads, size_t memoryMB);
+LIB2048_API void g2048_pool_destroy(g2048_pool* pool);
+LIB2048_API int g2048_pool_threads(const g2048_pool* pool);
+
+/* succ[4*i + d] and gains[4*i + d] get board i after move d (unchanged if
+ * illegal) and its score; masks[i] gets the legal move mask.  gains and
+ * masks may be NULL. */
+LIB2048_API int g2048_slide_batch(g2048_pool* pool, const uint64_t* boards, size_t n,
+	uint64_t* succ, int32_t* gains, uint8_t* masks);
+
+/* masks[i] = legal move mask of board i. */
+LIB2048_API int g2048_legal_moves_batch(g2048_pool* pool, const uint64_t* boards, size_t n,
+	uint8_t* masks);
+
+/* out[i] = heuristic value of board i with game score scores[i]. */
+LIB2048_API int g2048_eval_batch(g2048_pool* pool, const uint64_t* boards, const int32_t* scores,
+	size_t n, float* out);
+
+/* moves[i] = best move for board i with game score scores[i], searched for
+ * about msPerBoard milliseconds of wall time and at most maxDepth moves deep
+ * (<= 0 for no limit).  Boards are searched in parallel, one per thread,
+ * and each gets the whole msPerBoard, so a batch takes about
+ * msPerBoard * n / threads.  A single board gets the whole pool.  As in
+ * play, the time manager scales the budget for how crowded the board is and
+ * may extend it on close moves.  Requires a pool. */
+LIB2048_API int g2048_search_batch(g2048_pool* pool, const uint64_t* boards, const int32_t* scores,
+	size_t n, double msPerBoard, int maxDepth, int8_t* moves);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,232 @@
+#include <math.h>
+#include <stdio.h>
+#include <chrono>
+#include <thread>
+#include "mcts_player.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static const int MaxPathLength = 512;
+
+void MctsNode::Init(const Board& b, bool bChance_)
+{
+	board = b;
+	bChance = bChance_;
+	visits.store(0, std::memory_order_relaxed);
+	scoreSum.store(0, std::memory_order_relaxed);
+	kids.store(nullptr, std::memory_order_relaxed);
+}
+
+MctsPlayer::MctsPlayer(int numThreads_)
+	: numThreads(numThreads_), maxMS(30), maxRollouts(1 << 30),
+	  maxRolloutMoves(1000), maxNodes(1 << 20), bGreedyRollouts(false),
+	  exploration(1.0f), bVerbose(true), nodes(nullptr), arenaSize(0), root(nullptr), rootScore(0), seed(1)
+{
+	if (numThreads <= 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+}
+
+MctsPlayer::~MctsPlayer()
+{
+	delete[] nodes;
+}
+
+MctsNode* MctsPlayer::NewNodes(int n)
+{
+	int ix = nNodes.fetch_add(n, std::memory_order_relaxed);
+	if (ix + n > arenaSize) return nullptr;
+	return nodes + ix;
+}
+
+// Creates the kids of a leaf node.
+// Returns false if the board is dead or the node arena is full.
+bool MctsPlayer::Expand(MctsNode* node)
+{
+	if (node->kids.load(std::memory_order_acquire) != nullptr) return true;
+
+	MctsNode* block;
+	int nKids;
+	if (node->bChance) {
+		byte avail[16];
+		int nAvail = node->board.GetAvailableTiles(avail);
+		if (nAvail == 0) return false;
+		nKids = 2 * nAvail;
+		block = NewNodes(nKids);
+		if (block == nullptr) return false;
+		for(int i=0; i<nAvail; ++i){
+			for(int v=1; v<=2; ++v){
+				Board b = node->board;
+				b.SetCell(avail[i], v);
+				block[2*i + v-1].Init(b, false);
+			}
+		}
+	} else {
+		Board succ[NumDirections];
+		if (node->board.GenerateMoves(succ) == 0) return false;
+		nKids = NumDirections;
+		block = NewNodes(nKids);
+		if (block == nullptr) return false;
+		for(int i=0; i<NumDirections; ++i)
+			block[i].Init(succ[i], true);
+	}
+
+	// Another thread may have expanded the node first; the block is then
+	// simply left unused in the arena.
+	MctsNode* expected = nullptr;
+	node->kids.compare_exchange_strong(expected, block, std::memory_order_release,
+		std::memory_order_acquire);
+	return true;
+}
+
+MctsNode* MctsPlayer::SelectMove(MctsNode* node) const
+{
+	MctsNode* kids = node->kids.load(std::memory_order_acquire);
+	const float logN = log((float)std::max(1, node->visits.load(std::memory_order_relaxed)));
+	const float scale = 1.0f / std::max(1, maxGain.load(std::memory_order_relaxed));
+
+	MctsNode* best = nullptr;
+	float bestValue = -std::numeric_limits<float>::infinity();
+	for(int i=0; i<NumDirections; ++i){
+		MctsNode* kid = &kids[i];
+		if (kid->board == node->board) continue; // illegal move
+		int n = kid->visits.load(std::memory_order_relaxed);
+		if (n == 0) return kid;
+		float q = kid->scoreSum.load(std::memory_order_relaxed) * scale / n;
+		float value = q + exploration * sqrt(logN / n);
+		if (value > bestValue) {
+			bestValue = value;
+			best = kid;
+		}
+	}
+	return best;
+}
+
+int MctsPlayer::Rollout(Board board, RNG& rng) const
+{
+	static const byte BitCount[16] = { 0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4 };
+	Board succ[NumDirections];
+	for(int iMove=0; iMove<maxRolloutMoves; ++iMove){
+		const int legal = board.GenerateMoves(succ);
+		if (legal == 0) break;
+
+		// Pick the k-th legal move, or with greedy rollouts the legal move that
+		// scores the most, starting the scan at a random one to break ties.
+		int k = rng.NextInt() % BitCount[legal];
+		int dir = 0;
+		while(!(legal & (1 << dir)) || k-- > 0) ++dir;
+		if (bGreedyRollouts) {
+			int best = dir;
+			for(int i=1; i<NumDirections; ++i){
+				int d = (dir + i) % NumDirections;
+				if ((legal & (1 << d)) && succ[d].score > succ[best].score) best = d;
+			}
+			dir = best;
+		}
+		board = succ[dir];
+		board.AddRandomTile(rng);
+	}
+	return board.score - rootScore;
+}
+
+// Runs one selection / expansion / rollout / backup pass.
+// Returns false if the tree could not be descended (no legal moves at root).
+bool MctsPlayer::RunIteration(RNG& rng)
+{
+	MctsNode* path[MaxPathLength];
+	int nPath = 0;
+
+	MctsNode* node = root;
+	while(true) {
+		// Counting the visit before the rollout is done acts as a virtual loss.
+		int visits = node->visits.fetch_add(1, std::memory_order_relaxed) + 1;
+		path[nPath++] = node;
+		if (nPath == MaxPathLength) break;
+
+		MctsNode* kids = node->kids.load(std::memory_order_acquire);
+		if (kids == nullptr) {
+			if (visits < 2 && node != root) break;
+			if (!Expand(node)) break;
+			kids = node->kids.load(std::memory_order_acquire);
+		}
+
+		MctsNode* kid;
+		if (node->bChance) {
+			int nAvail = node->board.NumAvailableTiles();
+			int ix = rng.NextInt() % nAvail;
+			kid = &kids[2*ix + (rng.NextFloat() < 0.9f ? 0 : 1)];
+		} else {
+			kid = SelectMove(node);
+			if (kid == nullptr) break;
+		}
+		node = kid;
+	}
+
+	if (nPath == 1 && root->kids.load(std::memory_order_acquire) == nullptr) return false;
+
+	int gain = Rollout(path[nPath-1]->board, rng);
+	int prevMax = maxGain.load(std::memory_order_relaxed);
+	while(gain > prevMax && !maxGain.compare_exchange_weak(prevMax, gain, std::memory_order_relaxed));
+	for(int i=0; i<nPath; ++i)
+		path[i]->scoreSum.fetch_add(gain, std::memory_order_relaxed);
+	return true;
+}
+
+void MctsPlayer::SearchThread(int iThread)
+{
+	RNG rng(seed * 7919 + iThread);
+	const Clock::time_point start = Clock::now();
+	for(int iter=0; !bStop.load(std::memory_order_relaxed); ++iter){
+		if (nRollouts.fetch_add(1, std::memory_order_relaxed) >= maxRollouts) break;
+		if (!RunIteration(rng)) break;
+		if ((iter & 15) == 0) {
+			auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+			if (ms >= maxMS) break;
+		}
+	}
+	bStop.store(true, std::memory_order_relaxed);
+}
+
+Direction MctsPlayer::FindBestMove(const Board& board)
+{
+	Direction dirs[4];
+	int nDirs = board.GetLegalMoves(dirs);
+	if (nDirs == 0) return None;
+	if (nDirs == 1) return dirs[0];
+
+	// The arena is (re)allocated here, so maxNodes can change between moves.
+	if (nodes == nullptr || arenaSize != std::max(maxNodes, 1)) {
+		delete[] nodes;
+		arenaSize = std::max(maxNodes, 1);
+		nodes = new MctsNode[arenaSize];
+	}
+	nNodes.store(0);
+	nRollouts.store(0);
+	maxGain.store(1);
+	bStop.store(false);
+	rootScore = board.score;
+	++seed;
+	root = NewNodes(1);
+	root->Init(board, false);
+
+	std::vector<std::thread> threads;
+	for(int i=1; i<numThreads; ++i)
+		threads.push_back(std::thread(&MctsPlayer::SearchThread, this, i));
+	SearchThread(0);
+	for(unsigned int i=0; i<threads.size(); ++i)
+		threads[i].join();
+
+	Direction bestDir = None;
+	int bestVisits = -1;
+	MctsNode* kids = root->kids.load();
+	for(int i=0; i<NumDirections && kids != nullptr; ++i){
+		if (kids[i].board == board) continue;
+		int n = kids[i].visits.load();
+		if (n > bestVisits) {
+			bestVisits = n;
+			bestDir = (Direction)i;
+		}
+	}
+
+	if (bVerbose) printf("Rollouts: %d    nodes: %d\n", std::min(nRollouts.load(), maxRollouts),
+		std::min(nNodes.load(), arenaSize));
+	return bestDir;
+}
@@ -0,0 +1,66 @@
+#ifndef __MCTS_PLAYER_H__
+#define __MCTS_PLAYER_H__
+
+#include <atomic>
+#include <vector>
+#include "player.h"
+#include "rng.h"
+
+// Node in the Monte Carlo search tree.
+// Decision nodes hold a board where the next step is a move; their kids are
+// the chance nodes that result from each direction.  Chance nodes hold the
+// board right after a move; their kids are the 2*nAvail boards that result
+// from adding a random tile (a 2 and a 4 for each open cell).
+// Statistics are updated lock-free by all search threads.
+class MctsNode
+{
+public:
+	void Init(const Board& b, bool bChance);
+
+	Board board;
+	bool bChance;
+	std::atomic<int> visits;
+	std::atomic<long long> scoreSum; // sum of rollout score gains
+	std::atomic<MctsNode*> kids;     // contiguous block of kid nodes
+};
+
+// Tree-parallel MCTS player.  All threads share one tree; a thread adds a
+// virtual loss (a visit with no reward) on the way down so that other threads
+// are steered toward different lines until the rollout result is backed up.
+class MctsPlayer : public Player
+{
+public:
+	MctsPlayer(int numThreads = 0);
+	virtual ~MctsPlayer();
+
+	virtual Direction FindBestMove(const Board& board);
+
+	int numThreads;        // 0 = hardware concurrency
+	int maxMS;             // time budget per move
+	int maxRollouts;       // rollout budget per move
+	int maxRolloutMoves;   // rollouts stop after this many moves
+	int maxNodes;          // size of the node arena, applied at the next move
+	bool bGreedyRollouts;  // prefer merges during rollouts
+	float exploration;     // UCT exploration constant
+	bool bVerbose;         // print a summary of each search
+
+private:
+	void SearchThread(int iThread);
+	bool RunIteration(RNG& rng);
+	MctsNode* NewNodes(int n);
+	bool Expand(MctsNode* node);
+	MctsNode* SelectMove(MctsNode* node) const;
+	int Rollout(Board board, RNG& rng) const;
+
+	MctsNode* nodes;
+	int arenaSize;         // maxNodes when nodes was allocated
+	MctsNode* root;
+	std::atomic<int> nNodes;
+	std::atomic<int> nRollouts;
+	std::atomic<int> maxGain;
+	std::atomic<bool> bStop;
+	int rootScore;
+	unsigned int seed;
+};
+
+#endif
@@ -0,0 +1,191 @@
+#ifdef _WIN32
+#  define FD_SETSIZE 256
+#  include <winsock2.h>
+#  include <ws2tcpip.h>
+#  pragma comment(lib, "ws2_32.lib")
+typedef int socklen_t;
+#  define CloseSocket closesocket
+#  define SendFlags 0
+#else
+#  include <arpa/inet.h>
+#  include <netdb.h>
+#  include <netinet/in.h>
+#  include <netinet/tcp.h>
+#  include <sys/select.h>
+#  include <sys/socket.h>
+#  include <unistd.h>
+#  define INVALID_SOCKET (-1)
+#  define CloseSocket close
+#  ifdef MSG_NOSIGNAL
+#    define SendFlags MSG_NOSIGNAL // a dead peer is an error, not SIGPIPE
+#  else
+#    define SendFlags 0
+#  endif
+#endif
+#include <stdio.h>
+#include <string.h>
+#include "net.h"
+
+#ifdef _WIN32
+typedef SOCKET Handle;
+#else
+typedef int Handle;
+#endif
+
+static const intptr_t NoSocket = (intptr_t)INVALID_SOCKET;
+
+LineSocket::LineSocket() : fd(NoSocket)
+{
+}
+
+LineSocket::~LineSocket()
+{
+	Close();
+}
+
+bool LineSocket::Startup()
+{
+#ifdef _WIN32
+	WSADATA data;
+	return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+#else
+	return true;
+#endif
+}
+
+bool LineSocket::Connect(const char* host, int port)
+{
+	Close();
+	char service[16];
+	snprintf(service, sizeof(service), "%d", port);
+	addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo* addrs = NULL;
+	if (getaddrinfo(host, service, &hints, &addrs) != 0) return false;
+
+	for(addrinfo* a = addrs; a != NULL && fd == NoSocket; a = a->ai_next){
+		Handle h = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+		if (h == INVALID_SOCKET) continue;
+		if (connect(h, a->ai_addr, (socklen_t)a->ai_addrlen) == 0) {
+			// Messages are single short lines; send them as they are written.
+			int one = 1;
+			setsockopt(h, IPPROTO_TCP, TCP_NODELAY, (const char*)&one, sizeof(one));
+			fd = (intptr_t)h;
+		} else {
+			CloseSocket(h);
+		}
+	}
+	freeaddrinfo(addrs);
+	return fd != NoSocket;
+}
+
+bool LineSocket::Listen(int port, bool bLocalOnly)
+{
+	Close();
+	Handle h = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (h == INVALID_SOCKET) return false;
+	int one = 1;
+	setsockopt(h, SOL_SOCKET, SO_REUSEADDR, (const char*)&one, sizeof(one));
+
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((unsigned short)port);
+	addr.sin_addr.s_addr = htonl(bLocalOnly ? INADDR_LOOPBACK : INADDR_ANY);
+	if (bind(h, (const sockaddr*)&addr, sizeof(addr)) != 0 || listen(h, 64) != 0) {
+		CloseSocket(h);
+		return false;
+	}
+	fd = (intptr_t)h;
+	return true;
+}
+
+bool LineSocket::Accept(LineSocket* conn)
+{
+	Handle h = accept((Handle)fd, NULL, NULL);
+	if (h == INVALID_SOCKET) return false;
+	int one = 1;
+	setsockopt(h, IPPROTO_TCP, TCP_NODELAY, (const char*)&one, sizeof(one));
+	conn->Close();
+	conn->fd = (intptr_t)h;
+	return true;
+}
+
+bool LineSocket::IsOpen() const
+{
+	return fd != NoSocket;
+}
+
+void LineSocket::Close()
+{
+	if (fd != NoSocket) CloseSocket((Handle)fd);
+	fd = NoSocket;
+	inbuf.clear();
+}
+
+bool LineSocket::SendLine(const std::string& line)
+{
+	if (fd == NoSocket) return false;
+	const std::string msg = line + "\n";
+	size_t sent = 0;
+	while(sent < msg.size()){
+		const int n = send((Handle)fd, msg.data() + sent, (int)(msg.size() - sent), SendFlags);
+		if (n <= 0) return false;
+		sent += n;
+	}
+	return true;
+}
+
+bool LineSocket::TakeLine(std::string* line)
+{
+	const size_t eol = inbuf.find('\n');
+	if (eol == std::string::npos) return false;
+	line->assign(inbuf, 0, eol);
+	inbuf.erase(0, eol + 1);
+	return true;
+}
+
+bool LineSocket::ReadLine(std::string* line)
+{
+	while(!TakeLine(line)){
+		char buf[4096];
+		const int n = (fd == NoSocket ? 0 : recv((Handle)fd, buf, sizeof(buf), 0));
+		if (n <= 0) return false;
+		inbuf.append(buf, n);
+	}
+	return true;
+}
+
+bool LineSocket::ReceiveLines(std::vector<std::string>* lines)
+{
+	char buf[4096];
+	const int n = (fd == NoSocket ? 0 : recv((Handle)fd, buf, sizeof(buf), 0));
+	if (n <= 0) return false;
+	inbuf.append(buf, n);
+	std::string line;
+	while(TakeLine(&line)) lines->push_back(line);
+	return true;
+}
+
+int LineSocket::Wait(LineSocket* const* sockets, size_t n, int ms, std::vector<bool>* ready)
+{
+	fd_set readable;
+	FD_ZERO(&readable);
+	Handle maxFd = 0;
+	for(size_t i=0; i<n; ++i){
+		if (sockets[i]->fd == NoSocket) continue;
+		FD_SET((Handle)sockets[i]->fd, &readable);
+		if ((Handle)sockets[i]->fd > maxFd) maxFd = (Handle)sockets[i]->fd;
+	}
+	timeval timeout;
+	timeout.tv_sec = ms / 1000;
+	timeout.tv_usec = (ms % 1000) * 1000;
+	const int nReady = select((int)maxFd + 1, &readable, NULL, NULL, &timeout);
+
+	ready->assign(n, false);
+	for(size_t i=0; nReady > 0 && i<n; ++i)
+		(*ready)[i] = (sockets[i]->fd != NoSocket && FD_ISSET((Handle)sockets[i]->fd, &readable));
+	return nReady > 0 ? nReady : 0;
+}
@@ -0,0 +1,51 @@
+#ifndef __NET_H__
+#define __NET_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// A TCP connection carrying newline-terminated text messages, over Winsock
+// or BSD sockets.  Calls block unless noted.  Call Startup once per process
+// before anything else.
+class LineSocket
+{
+public:
+	LineSocket();
+	~LineSocket();
+
+	static bool Startup();
+
+	bool Connect(const char* host, int port);
+	// Listens on the loopback interface only if bLocalOnly.
+	bool Listen(int port, bool bLocalOnly);
+	// Waits for a connection on a listening socket and hands it to conn.
+	bool Accept(LineSocket* conn);
+
+	bool IsOpen() const;
+	void Close();
+
+	// Sends line followed by a newline.
+	bool SendLine(const std::string& line);
+	// Waits for the next line.  False once the peer closes or on error.
+	bool ReadLine(std::string* line);
+	// Reads whatever has arrived, without waiting if Wait said the socket is
+	// ready, and appends the complete lines.  False once the peer closes.
+	bool ReceiveLines(std::vector<std::string>* lines);
+
+	// Waits up to ms for any of the sockets to have data or a connection to
+	// accept; ready[i] is set for those that do.  Returns how many.
+	static int Wait(LineSocket* const* sockets, size_t n, int ms, std::vector<bool>* ready);
+
+private:
+	LineSocket(const LineSocket&);
+	LineSocket& operator=(const LineSocket&);
+
+	bool TakeLine(std::string* line);
+
+	intptr_t fd;
+	std::string inbuf;
+};
+
+#endif
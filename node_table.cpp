@@ -0,0 +1,53 @@
+#include <algorithm>
+#include "node_table.h"
+
+static const int MinBits = 4;
+
+NodeTable::NodeTable() : shift(64), count(0)
+{
+	Reset(0);
+}
+
+void NodeTable::Clear()
+{
+	const Entry empty = { 0, 0 };
+	std::fill(entries.begin(), entries.end(), empty);
+	count = 0;
+}
+
+int NodeTable::SlotBitsFor(size_t n)
+{
+	int bits = MinBits;
+	while(((size_t)1 << bits) < 2 * n) ++bits;
+	return bits;
+}
+
+void NodeTable::Reset(size_t n)
+{
+	const int bits = SlotBitsFor(n);
+	if (bits == SlotBits()) {
+		Clear();
+		return;
+	}
+	// A fresh array, so a table sized for a big ply doesn't keep its memory.
+	const Entry empty = { 0, 0 };
+	PageVector<Entry>((size_t)1 << bits, empty).swap(entries);
+	shift = 64 - bits;
+	count = 0;
+}
+
+// Rehashes everything into numSlots slots.
+void NodeTable::Resize(size_t numSlots)
+{
+	PageVector<Entry> old(numSlots, Entry()); // zeroed: all empty
+	old.swap(entries);
+	shift = 64;
+	for(size_t n = numSlots; n > 1; n >>= 1) --shift;
+	const size_t mask = entries.size() - 1;
+	for(size_t j=0; j<old.size(); ++j){
+		if (old[j].key == 0) continue;
+		size_t i = (size_t)(Hash(old[j].key) >> shift);
+		while(entries[i].key != 0) i = (i + 1) & mask;
+		entries[i] = old[j];
+	}
+}
@@ -0,0 +1,91 @@
+#ifndef __NODE_TABLE_H__
+#define __NODE_TABLE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <xmmintrin.h>
+#include "large_pages.h"
+
+// Map from canonical board to node index for deduplicating a ply: open
+// addressing with linear probing in one flat array, at most half full.
+// The slot is the top bits of the hash, so keys grouped by the top bits of
+// their hash probe one region of the table at a time, and a probe's line
+// can be prefetched ahead of time.  Key 0 (the empty board) is reserved for
+// empty slots; it is never the result of a move.
+class NodeTable
+{
+public:
+	NodeTable();
+
+	// Empties the table, keeping its memory.
+	void Clear();
+	// Empties the table and sizes it for n keys without growing.
+	void Reset(size_t n);
+
+	size_t Size() const { return count; }
+	size_t Bytes() const { return entries.size() * sizeof(Entry); }
+	// Bytes of a table Reset for n keys.
+	static size_t BytesFor(size_t n) { return ((size_t)1 << SlotBitsFor(n)) * sizeof(Entry); }
+	// log2 of the number of slots; the slot of a key is the top SlotBits()
+	// bits of its hash.
+	int SlotBits() const { return 64 - shift; }
+
+	static uint64_t Hash(uint64_t key)
+	{
+		// MurmurHash3's finalizer; independent of the multiplicative hashes
+		// used to pick shards and cache slots.
+		key ^= key >> 33;
+		key *= 0xFF51AFD7ED558CCDULL;
+		key ^= key >> 33;
+		key *= 0xC4CEB9FE1A85EC53ULL;
+		return key ^ (key >> 33);
+	}
+
+	void Prefetch(uint64_t hash) const
+	{
+		_mm_prefetch((const char*)&entries[(size_t)(hash >> shift)], _MM_HINT_T0);
+	}
+
+	// Returns the value of key, first adding it with the given value if it
+	// isn't there.  *bInserted says which.
+	uint32_t Insert(uint64_t key, uint32_t value, bool* bInserted)
+	{
+		return Insert(key, Hash(key), value, bInserted);
+	}
+	uint32_t Insert(uint64_t key, uint64_t hash, uint32_t value, bool* bInserted)
+	{
+		if (2 * (count + 1) > entries.size()) Resize(2 * entries.size());
+		const size_t mask = entries.size() - 1;
+		for(size_t i = (size_t)(hash >> shift); ; i = (i + 1) & mask){
+			Entry& e = entries[i];
+			if (e.key == key) {
+				*bInserted = false;
+				return e.value;
+			}
+			if (e.key == 0) {
+				e.key = key;
+				e.value = value;
+				++count;
+				*bInserted = true;
+				return value;
+			}
+		}
+	}
+
+private:
+	struct Entry
+	{
+		uint64_t key;
+		uint32_t value;
+	};
+
+	void Resize(size_t numSlots);
+	static int SlotBitsFor(size_t n);
+
+	PageVector<Entry> entries; // size is a power of two
+	int shift;                  // 64 - log2(size)
+	size_t count;
+};
+
+#endif
@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <unordered_map>
+#include "opening_book.h"
+#include "search_player.h"
+#include "thread_pool.h"
+
+static const char BookMagic[8] = { '2','0','4','8','B','O','O','K' };
+static const uint32_t BookVersion = 2; // 2: canonical boards break ties by bits
+
+////////////////////////////////////////////////////////////
+// OpeningBook
+
+// File layout: magic, version, entry count, then the entries in key order.
+bool OpeningBook::Load(const char* path)
+{
+	FILE* f = fopen(path, "rb");
+	if (f == NULL) return false;
+
+	char magic[8];
+	uint32_t version = 0, n = 0;
+	bool bOK = fread(magic, 1, 8, f) == 8 && memcmp(magic, BookMagic, 8) == 0
+		&& fread(&version, sizeof(version), 1, f) == 1 && version == BookVersion
+		&& fread(&n, sizeof(n), 1, f) == 1;
+	if (bOK) {
+		entries.resize(n);
+		bOK = (n == 0 || fread(&entries[0], sizeof(Entry), n, f) == n);
+	}
+	fclose(f);
+
+	if (!bOK || !std::is_sorted(entries.begin(), entries.end())) {
+		entries.clear();
+		return false;
+	}
+	return true;
+}
+
+bool OpeningBook::Save(const char* path) const
+{
+	FILE* f = fopen(path, "wb");
+	if (f == NULL) return false;
+	const uint32_t n = (uint32_t)entries.size();
+	bool bOK = fwrite(BookMagic, 1, 8, f) == 8
+		&& fwrite(&BookVersion, sizeof(BookVersion), 1, f) == 1
+		&& fwrite(&n, sizeof(n), 1, f) == 1
+		&& (n == 0 || fwrite(&entries[0], sizeof(Entry), n, f) == n);
+	return (fclose(f) == 0) && bOK;
+}
+
+Direction OpeningBook::Lookup(const Board& board) const
+{
+	if (entries.empty()) return None;
+	Entry key;
+	key.position = board.GetCanonical().Bits();
+	std::vector<Entry>::const_iterator it = std::lower_bound(entries.begin(), entries.end(), key);
+	if (it == entries.end() || it->position != key.position) return None;
+
+	Board succ[NumDirections];
+	const int legal = board.GenerateMoves(succ);
+	for(int dir=0; dir<NumDirections; ++dir){
+		if ((legal & (1 << dir)) && succ[dir].GetCanonical().Bits() == it->result)
+			return (Direction)dir;
+	}
+	return None;
+}
+
+void OpeningBook::Add(const Board& board, Direction move)
+{
+	Board b = board;
+	if (!b.Slide(move)) return;
+	Entry e;
+	e.position = board.GetCanonical().Bits();
+	e.result = b.GetCanonical().Bits();
+	entries.push_back(e);
+}
+
+void OpeningBook::Sort()
+{
+	std::sort(entries.begin(), entries.end());
+	// Keep the first entry for each position.
+	std::vector<Entry>::iterator last = std::unique(entries.begin(), entries.end(),
+		[](const Entry& a, const Entry& b) { return a.position == b.position; });
+	entries.erase(last, entries.end());
+}
+
+////////////////////////////////////////////////////////////
+// BookBuilder
+
+BookBuilder::BookBuilder()
+	: sampleGames(1000), bookMoves(20), maxPositions(10000), searchMS(1000.0),
+	  numThreads(0), memoryMB(4096)
+{
+}
+
+void BookBuilder::Build(OpeningBook* book)
+{
+	ThreadPool pool(numThreads);
+
+	// Count the canonical positions to move from in the sample games, with
+	// the game score of the first time each was seen (the evaluation needs a
+	// plausible score).
+	std::unordered_map<uint64_t, std::pair<int, int> > counts;
+	{
+		SearchPlayer sampler(&pool);
+		sampler.maxMoveDepth = 2;
+		sampler.timeManager.baseMS = 1e9;
+		for(int i=0; i<sampleGames; ++i){
+			RNG rng(i + 1);
+			Board board;
+			board.AddRandomTile(rng);
+			board.AddRandomTile(rng);
+			sampler.NewGame();
+			for(int iMove=0; iMove<bookMoves; ++iMove){
+				std::pair<int, int>& seen = counts[board.GetCanonical().Bits()];
+				if (seen.first++ == 0) seen.second = board.score;
+				const Direction move = sampler.FindBestMove(board);
+				if (move == None) break;
+				board.Slide(move);
+				board.AddRandomTile(rng);
+			}
+		}
+	}
+
+	std::vector<std::pair<int, uint64_t> > byCount;
+	byCount.reserve(counts.size());
+	for(std::unordered_map<uint64_t, std::pair<int, int> >::const_iterator it = counts.begin();
+		it != counts.end(); ++it)
+		byCount.push_back(std::make_pair(it->second.first, it->first));
+	const size_t n = std::min(maxPositions, byCount.size());
+	std::partial_sort(byCount.begin(), byCount.begin() + n, byCount.end(),
+		[](const std::pair<int, uint64_t>& a, const std::pair<int, uint64_t>& b) {
+			return a.first > b.first || (a.first == b.first && a.second < b.second);
+		});
+	printf("Book: %lu distinct positions in %d games, searching %lu\n",
+		(unsigned long)byCount.size(), sampleGames, (unsigned long)n);
+
+	// Deep search of each position, one player per thread.
+	SearchPlayerSet players(pool.NumThreads(), memoryMB);
+	players.SetBudget(searchMS, 0, true);
+	std::vector<Direction> moves(n, None);
+	pool.ParallelFor(n, 1, [&](size_t begin, size_t end, int iThread) {
+		for(size_t i=begin; i<end; ++i){
+			Board board;
+			board.SetBits(byCount[i].second);
+			board.score = counts.find(byCount[i].second)->second.second;
+			moves[i] = players[iThread].FindBestMove(board);
+		}
+	});
+
+	for(size_t i=0; i<n; ++i){
+		if (moves[i] == None) continue;
+		Board board;
+		board.SetBits(byCount[i].second);
+		book->Add(board, moves[i]);
+	}
+	book->Sort();
+}
@@ -0,0 +1,60 @@
+#ifndef __OPENING_BOOK_H__
+#define __OPENING_BOOK_H__
+
+#include <stdint.h>
+#include <vector>
+#include "board.h"
+
+// Precomputed moves for common early positions.
+// Entries are keyed by canonical board and sorted, so a lookup is a binary
+// search.  The move is stored as the canonical board it leads to, which
+// makes it independent of how the position is oriented: the lookup plays
+// whichever legal move reaches an equivalent board.
+class OpeningBook
+{
+public:
+	bool Load(const char* path);
+	bool Save(const char* path) const;
+
+	// Best move for the board, or None if it isn't in the book.
+	Direction Lookup(const Board& board) const;
+
+	// Adds the position board (any orientation) with its chosen move.
+	// Call Sort before the next Lookup or Save.
+	void Add(const Board& board, Direction move);
+	void Sort();
+
+	size_t Size() const { return entries.size(); }
+
+private:
+	struct Entry
+	{
+		uint64_t position; // canonical board before the move
+		uint64_t result;   // canonical board after it
+		bool operator<(const Entry& other) const { return position < other.position; }
+	};
+
+	std::vector<Entry> entries;
+};
+
+// Builds a book offline.  Sample games played by a fast search find the
+// positions that come up most often in the first bookMoves moves; each of
+// the top maxPositions is then searched with a fixed budget of searchMS of
+// wall time, spread over numThreads threads with a search player each.  The
+// players search side by side, but each position gets the whole budget.
+class BookBuilder
+{
+public:
+	BookBuilder();
+
+	void Build(OpeningBook* book);
+
+	int sampleGames;
+	int bookMoves;
+	size_t maxPositions;
+	double searchMS;     // per position, in wall time
+	int numThreads;      // 0 = one per core
+	size_t memoryMB;     // shared by all threads
+};
+
+#endif
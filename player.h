@@ -6,6 +6,8 @@
 class Player
 {
 public:
+	virtual ~Player() {}
+	virtual void NewGame() {}
 	virtual Direction FindBestMove(const Board& board) = 0;	
 };
 
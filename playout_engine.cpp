@@ -0,0 +1,134 @@
+#include <assert.h>
+#include <emmintrin.h>
+#include "playout_engine.h"
+
+static const uint64_t NibbleLowBits = 0x1111111111111111ULL;
+
+PlayoutEngine::PlayoutEngine(int maxGames_) : maxGames(maxGames_)
+{
+  // Round up so the SIMD passes can always work on pairs of boards.
+  const int n = (maxGames + 1) & ~1;
+  boards.resize(n);
+  scores.resize(n);
+  depths.resize(n);
+  ids.resize(n);
+  transposed.resize(n);
+  empty.resize(n);
+  next.resize(n);
+  gains.resize(n);
+  legal.resize(n);
+}
+
+// Transposes two boards at once; same bit tricks as Board::Transpose.
+static inline __m128i Transpose2(__m128i x)
+{
+  const __m128i m1 = _mm_set1_epi64x(0xF0F00F0FF0F00F0FLL);
+  const __m128i m2 = _mm_set1_epi64x(0x0000F0F00000F0F0LL);
+  const __m128i m3 = _mm_set1_epi64x(0x0F0F00000F0F0000LL);
+  const __m128i m4 = _mm_set1_epi64x(0xFF00FF0000FF00FFLL);
+  const __m128i m5 = _mm_set1_epi64x(0x00FF00FF00000000LL);
+  const __m128i m6 = _mm_set1_epi64x(0x00000000FF00FF00LL);
+  __m128i a = _mm_or_si128(_mm_and_si128(x, m1),
+    _mm_or_si128(_mm_slli_epi64(_mm_and_si128(x, m2), 12),
+                 _mm_srli_epi64(_mm_and_si128(x, m3), 12)));
+  return _mm_or_si128(_mm_and_si128(a, m4),
+    _mm_or_si128(_mm_srli_epi64(_mm_and_si128(a, m5), 24),
+                 _mm_slli_epi64(_mm_and_si128(a, m6), 24)));
+}
+
+// Marks the low bit of every zero nibble for two boards at once.
+static inline __m128i EmptyCells2(__m128i x)
+{
+  const __m128i low = _mm_set1_epi64x((long long)NibbleLowBits);
+  __m128i t = _mm_or_si128(x, _mm_srli_epi64(x, 1));
+  t = _mm_or_si128(t, _mm_srli_epi64(t, 2));
+  return _mm_andnot_si128(t, low);
+}
+
+void PlayoutEngine::GenerateMoves(int nLive)
+{
+  for(int i=0; i<nLive; i+=2){
+    __m128i x = _mm_loadu_si128((const __m128i*)&boards[i]);
+    _mm_storeu_si128((__m128i*)&transposed[i], Transpose2(x));
+  }
+
+  for(int i=0; i<nLive; ++i){
+    const uint64_t b = boards[i];
+    const uint64_t t = transposed[i];
+    uint64_t succ[NumDirections];
+    int gain[NumDirections];
+    const byte mask = (byte)Board::GenerateMoves(b, t, succ, gain);
+    legal[i] = mask;
+    if (mask == 0) continue;
+
+    // Pick the k-th legal direction.
+    static const byte BitCount[16] = { 0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4 };
+    int k = rng.NextInt() % BitCount[mask];
+    int dir = 0;
+    for(;; ++dir){
+      if ((mask & (1 << dir)) && k-- == 0) break;
+    }
+    next[i] = succ[dir];
+    gains[i] = gain[dir];
+  }
+}
+
+void PlayoutEngine::SpawnTiles(int nLive)
+{
+  for(int i=0; i<nLive; i+=2){
+    __m128i x = _mm_loadu_si128((const __m128i*)&boards[i]);
+    _mm_storeu_si128((__m128i*)&empty[i], EmptyCells2(x));
+  }
+
+  for(int i=0; i<nLive; ++i){
+    uint64_t m = empty[i];
+    // A board after a move always has between 1 and 15 open cells, so the
+    // nibble sum can't overflow.
+    const int nOpen = (int)((m * NibbleLowBits) >> 60);
+    assert(nOpen > 0);
+    for(int k = rng.NextInt() % nOpen; k > 0; --k)
+      m &= m - 1;
+    const uint64_t cell = m & (~m + 1);
+    boards[i] |= cell * (rng.NextFloat() < 0.9f ? 1 : 2);
+  }
+}
+
+void PlayoutEngine::Run(const uint64_t* startBoards, const int* startScores, int n,
+                        unsigned int seed, int* finalScores, int* depths_)
+{
+  assert(n <= maxGames);
+  rng = RNG(seed); // Seed alone keeps the draws left in the old buffer
+  for(int i=0; i<n; ++i){
+    boards[i] = startBoards[i];
+    scores[i] = startScores[i];
+    depths[i] = 0;
+    ids[i] = i;
+  }
+
+  int nLive = n;
+  while(nLive > 0){
+    GenerateMoves(nLive);
+
+    // Retire dead games by swapping in the last live game.
+    for(int i=0; i<nLive; ){
+      if (legal[i] != 0) { ++i; continue; }
+      finalScores[ids[i]] = scores[i];
+      depths_[ids[i]] = depths[i];
+      --nLive;
+      boards[i] = boards[nLive];
+      scores[i] = scores[nLive];
+      depths[i] = depths[nLive];
+      ids[i] = ids[nLive];
+      next[i] = next[nLive];
+      gains[i] = gains[nLive];
+      legal[i] = legal[nLive];
+    }
+
+    for(int i=0; i<nLive; ++i){
+      boards[i] = next[i];
+      scores[i] += gains[i];
+      ++depths[i];
+    }
+    SpawnTiles(nLive);
+  }
+}
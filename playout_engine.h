@@ -0,0 +1,45 @@
+#ifndef __PLAYOUT_ENGINE_H__
+#define __PLAYOUT_ENGINE_H__
+
+#include <vector>
+#include "board.h"
+#include "rng.h"
+
+// Plays many independent random games in lockstep.
+// Game state is kept as structure-of-arrays (boards as 64-bit words) and
+// every step advances all live games: generate the four successors, pick a
+// random legal move, and spawn a tile.  Finished games are swapped out of
+// the live range so the arrays stay dense.
+class PlayoutEngine
+{
+public:
+  PlayoutEngine(int maxGames);
+
+  // Plays each of the n boards to the end with uniformly random legal moves.
+  // finalScores[i] is the game score when board i dies (starting from
+  // scores[i]) and depths[i] is the number of moves played.
+  void Run(const uint64_t* startBoards, const int* startScores, int n,
+           unsigned int seed, int* finalScores, int* depths);
+
+  int MaxGames() const { return maxGames; }
+
+private:
+  void GenerateMoves(int nLive);
+  void SpawnTiles(int nLive);
+
+  int maxGames;
+  RNG rng;
+
+  // Per live game; index i is slot i of the live range.
+  std::vector<uint64_t> boards;
+  std::vector<int> scores;
+  std::vector<int> depths;
+  std::vector<int> ids;           // index into the caller's arrays
+  std::vector<uint64_t> transposed;
+  std::vector<uint64_t> empty;    // low bit of each open cell's nibble
+  std::vector<uint64_t> next;     // board after the chosen move
+  std::vector<int> gains;         // score of the chosen move
+  std::vector<byte> legal;        // bit per direction
+};
+
+#endif
@@ -0,0 +1,264 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include "position_suite.h"
+#include "rng.h"
+#include "search_player.h"
+#include "thread_pool.h"
+
+static const char SuiteHeader[] = "2048-position-suite 1";
+
+const char* PhaseName[NumPhases] = { "early", "mid", "late" };
+
+GamePhase PhaseOf(const Board& board)
+{
+	const int maxTile = board.MaxTile();
+	return maxTile < 8 ? Early : (maxTile < 11 ? Mid : Late);
+}
+
+// Parses a float or "-" (for which it gives dash) at *p, advancing past it.
+static bool ParseValue(const char** p, float dash, float* value)
+{
+	int len = 0;
+	if (sscanf(*p, " -%n", &len) == 0 && len > 0 && ((*p)[len] == ' ' || (*p)[len] == '\n'
+		|| (*p)[len] == '\r' || (*p)[len] == '\0')) {
+		*value = dash;
+	} else if (sscanf(*p, "%f%n", value, &len) != 1) {
+		return false;
+	}
+	*p += len;
+	return true;
+}
+
+////////////////////////////////////////////////////////////
+// PositionSuite
+
+bool PositionSuite::Load(const char* path)
+{
+	positions.clear();
+	FILE* f = fopen(path, "r");
+	if (f == NULL) return false;
+
+	char line[512];
+	bool bOK = fgets(line, sizeof(line), f) != NULL && strncmp(line, SuiteHeader, strlen(SuiteHeader)) == 0;
+	while(bOK && fgets(line, sizeof(line), f) != NULL){
+		if (line[0] == '#' || line[0] == '\n' || line[0] == '\r') continue;
+		SuitePosition pos;
+		unsigned long long bits;
+		char phase[16];
+		int best, len = 0;
+		bOK = sscanf(line, "%llx %d %15s %d%n", &bits, &pos.board.score, phase, &best, &len) == 4
+			&& best >= 0 && best < NumDirections;
+		pos.board.SetBits(bits);
+		pos.best = (Direction)best;
+		pos.phase = NumPhases;
+		for(int i=0; i<NumPhases; ++i)
+			if (strcmp(phase, PhaseName[i]) == 0) pos.phase = (GamePhase)i;
+		bOK = bOK && pos.phase != NumPhases;
+		const char* p = line + len;
+		for(int i=0; bOK && i<NumDirections; ++i)
+			bOK = ParseValue(&p, -std::numeric_limits<float>::infinity(), &pos.score[i]);
+		for(int i=0; bOK && i<NumDirections; ++i)
+			bOK = ParseValue(&p, 1.0f, &pos.probDeath[i]);
+		if (bOK) positions.push_back(pos);
+	}
+	fclose(f);
+	if (!bOK) positions.clear();
+	return bOK;
+}
+
+bool PositionSuite::Save(const char* path) const
+{
+	FILE* f = fopen(path, "w");
+	if (f == NULL) return false;
+	fprintf(f, "%s\n", SuiteHeader);
+	fprintf(f, "# board score phase best score[left right up down] death[left right up down]\n");
+	for(size_t i=0; i<positions.size(); ++i){
+		const SuitePosition& pos = positions[i];
+		fprintf(f, "%016llx %d %s %d", (unsigned long long)pos.board.Bits(), pos.board.score,
+			PhaseName[pos.phase], (int)pos.best);
+		for(int d=0; d<NumDirections; ++d){
+			if (isinf(pos.score[d])) fprintf(f, " -");
+			else fprintf(f, " %.6g", pos.score[d]);
+		}
+		for(int d=0; d<NumDirections; ++d){
+			if (isinf(pos.score[d])) fprintf(f, " -");
+			else fprintf(f, " %.6g", pos.probDeath[d]);
+		}
+		fprintf(f, "\n");
+	}
+	return fclose(f) == 0;
+}
+
+bool PositionSuite::Agrees(const SuitePosition& pos, Direction move)
+{
+	if (move == pos.best) return true;
+	if (move == None) return false;
+	Board a = pos.board, b = pos.board;
+	return a.Slide(move) && b.Slide(pos.best) && a.GetCanonical().Bits() == b.GetCanonical().Bits();
+}
+
+////////////////////////////////////////////////////////////
+// SuiteBuilder
+
+SuiteBuilder::SuiteBuilder()
+	: sampleGames(100), numPositions(3000), referenceMS(2000.0), numThreads(0), memoryMB(4096)
+{
+}
+
+void SuiteBuilder::Build(PositionSuite* suite)
+{
+	ThreadPool pool(numThreads);
+
+	// Reservoir sample of each phase's positions over the sample games.
+	const size_t quota = (numPositions + NumPhases - 1) / NumPhases;
+	std::vector<Board> samples[NumPhases];
+	long long seen[NumPhases] = { 0 };
+	{
+		SearchPlayer sampler(&pool);
+		sampler.bVerbose = false;
+		sampler.maxMoveDepth = 2;
+		sampler.timeManager.baseMS = 1e9;
+		RNG pick(12345);
+		for(int i=0; i<sampleGames; ++i){
+			RNG rng(i + 1);
+			Board board;
+			board.AddRandomTile(rng);
+			board.AddRandomTile(rng);
+			sampler.NewGame();
+			while(true){
+				Direction moves[NumDirections];
+				if (board.GetLegalMoves(moves) > 1) {
+					const GamePhase phase = PhaseOf(board);
+					const long long n = seen[phase]++;
+					if (samples[phase].size() < quota) {
+						samples[phase].push_back(board);
+					} else {
+						const unsigned long long j = ((unsigned long long)pick.NextInt() << 32 | pick.NextInt()) % (n + 1);
+						if (j < quota) samples[phase][(size_t)j] = board;
+					}
+				}
+				const Direction move = sampler.FindBestMove(board);
+				if (move == None) break;
+				board.Slide(move);
+				board.AddRandomTile(rng);
+			}
+		}
+	}
+
+	std::vector<SuitePosition> positions;
+	for(int phase=0; phase<NumPhases; ++phase){
+		printf("Suite: %lld %s positions in %d games, keeping %lu\n", seen[phase], PhaseName[phase],
+			sampleGames, (unsigned long)samples[phase].size());
+		for(size_t i=0; i<samples[phase].size(); ++i){
+			SuitePosition pos;
+			pos.board = samples[phase][i];
+			pos.phase = (GamePhase)phase;
+			positions.push_back(pos);
+		}
+	}
+
+	// Reference searches, one player per thread.
+	SearchPlayerSet players(pool.NumThreads(), memoryMB);
+	players.SetBudget(referenceMS, 0, true);
+	pool.ParallelFor(positions.size(), 1, [&](size_t begin, size_t end, int iThread) {
+		SearchPlayer& player = players[iThread];
+		for(size_t i=begin; i<end; ++i){
+			SuitePosition& pos = positions[i];
+			pos.best = player.FindBestMove(pos.board);
+			std::copy(player.stats.rootScore, player.stats.rootScore + NumDirections, pos.score);
+			std::copy(player.stats.rootProbDeath, player.stats.rootProbDeath + NumDirections, pos.probDeath);
+		}
+	});
+
+	suite->positions.clear();
+	for(size_t i=0; i<positions.size(); ++i)
+		if (positions[i].best != None) suite->positions.push_back(positions[i]);
+}
+
+////////////////////////////////////////////////////////////
+// SuiteReport
+
+SuiteReport::SuiteReport() : wallMS(0.0), numThreads(1)
+{
+	for(int i=0; i<NumPhases; ++i){
+		n[i] = nAgree[i] = 0;
+		scoreLoss[i] = nodes[i] = ms[i] = maxMS[i] = 0.0;
+	}
+}
+
+void SuiteReport::Print() const
+{
+	size_t nAll = 0, agreeAll = 0;
+	double lossAll = 0.0, nodesAll = 0.0, msAll = 0.0, maxAll = 0.0;
+	for(int i=0; i<=NumPhases; ++i){
+		const bool bTotal = (i == NumPhases);
+		const size_t nn = bTotal ? nAll : n[i];
+		const size_t na = bTotal ? agreeAll : nAgree[i];
+		const double loss = bTotal ? lossAll : scoreLoss[i];
+		const double nd = bTotal ? nodesAll : nodes[i];
+		const double t = bTotal ? msAll : ms[i];
+		const double tMax = bTotal ? maxAll : maxMS[i];
+		if (!bTotal) {
+			nAll += n[i];
+			agreeAll += nAgree[i];
+			lossAll += scoreLoss[i];
+			nodesAll += nodes[i];
+			msAll += ms[i];
+			maxAll = std::max(maxAll, maxMS[i]);
+		}
+		if (nn == 0) continue;
+		printf("%-6s %5lu positions  agree %5.1f%%  loss %.4f  %6.2fM nodes/s  %7.1fms/decision (max %.1fms)\n",
+			bTotal ? "all" : PhaseName[i], (unsigned long)nn, 100.0 * na / nn, loss / nn,
+			nd / std::max(t, 1e-3) / 1000.0, t / nn, tMax);
+	}
+	printf("Wall time %.1fs on %d threads\n", wallMS / 1000.0, numThreads);
+}
+
+////////////////////////////////////////////////////////////
+// SuiteRunner
+
+SuiteRunner::SuiteRunner() : msPerPosition(100.0), maxDepth(0), numThreads(0), memoryMB(4096)
+{
+}
+
+void SuiteRunner::Run(const PositionSuite& suite, SuiteReport* report)
+{
+	typedef std::chrono::steady_clock Clock;
+	ThreadPool pool(numThreads);
+	SearchPlayerSet players(pool.NumThreads(), memoryMB);
+	players.SetBudget(maxDepth > 0 ? 1e9 : msPerPosition, maxDepth);
+
+	const size_t n = suite.positions.size();
+	std::vector<Direction> moves(n);
+	std::vector<size_t> nodes(n);
+	std::vector<double> ms(n);
+	const Clock::time_point start = Clock::now();
+	pool.ParallelFor(n, 1, [&](size_t begin, size_t end, int iThread) {
+		SearchPlayer& player = players[iThread];
+		for(size_t i=begin; i<end; ++i){
+			const Clock::time_point t0 = Clock::now();
+			moves[i] = player.FindBestMove(suite.positions[i].board);
+			ms[i] = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+			nodes[i] = player.stats.nodes;
+		}
+	});
+
+	*report = SuiteReport();
+	report->wallMS = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	report->numThreads = pool.NumThreads();
+	for(size_t i=0; i<n; ++i){
+		const SuitePosition& pos = suite.positions[i];
+		const int phase = pos.phase;
+		++report->n[phase];
+		if (PositionSuite::Agrees(pos, moves[i])) ++report->nAgree[phase];
+		else if (moves[i] != None && !isinf(pos.score[moves[i]]))
+			report->scoreLoss[phase] += std::max(0.0f, pos.score[pos.best] - pos.score[moves[i]]);
+		report->nodes[phase] += nodes[i];
+		report->ms[phase] += ms[i];
+		report->maxMS[phase] = std::max(report->maxMS[phase], ms[i]);
+	}
+}
@@ -0,0 +1,95 @@
+#ifndef __POSITION_SUITE_H__
+#define __POSITION_SUITE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "board.h"
+
+// Game phase of a position, by its largest tile.
+enum GamePhase { Early, Mid, Late, NumPhases }; // < 256, < 2048, the rest
+
+extern const char* PhaseName[NumPhases];
+GamePhase PhaseOf(const Board& board);
+
+// A position with the verdict of a reference search: its best move and
+// the backed-up score and death probability of every legal move.
+struct SuitePosition
+{
+	Board board;
+	GamePhase phase;
+	Direction best;
+	float score[NumDirections];     // -infinity if illegal
+	float probDeath[NumDirections]; // 1 if illegal
+};
+
+// A fixed set of positions for judging changes to the search or the
+// evaluation.  Saved as text: a header line, then one position per line,
+//   <board hex> <game score> <phase> <best move> <score x4> <death x4>
+// with "-" for the values of illegal moves.  Lines starting with # are
+// comments.
+class PositionSuite
+{
+public:
+	bool Load(const char* path);
+	bool Save(const char* path) const;
+
+	// True if move is the reference move or leads to an equivalent board.
+	static bool Agrees(const SuitePosition& pos, Direction move);
+
+	std::vector<SuitePosition> positions;
+};
+
+// Builds a suite.  Sample games played by a fast search supply the
+// positions; numPositions are kept, split evenly between the phases and
+// drawn uniformly from each phase's positions (fewer if a phase is short,
+// forced moves never).  Each is then searched for a fixed referenceMS of
+// wall time (scaled by the time manager for how crowded it is), spread over
+// numThreads threads with a search player each.
+class SuiteBuilder
+{
+public:
+	SuiteBuilder();
+
+	void Build(PositionSuite* suite);
+
+	int sampleGames;
+	size_t numPositions;
+	double referenceMS;
+	int numThreads;   // 0 = one per core
+	size_t memoryMB;  // shared by all threads
+};
+
+// Results of running a suite, per phase.
+struct SuiteReport
+{
+	SuiteReport();
+	void Print() const;
+
+	size_t n[NumPhases];
+	size_t nAgree[NumPhases];
+	double scoreLoss[NumPhases]; // reference score of the best move minus the one played
+	double nodes[NumPhases];
+	double ms[NumPhases];        // total time to decide
+	double maxMS[NumPhases];
+	double wallMS;               // for the whole suite
+	int numThreads;
+};
+
+// Plays the suite's positions with search players configured alike, in
+// parallel, one player per thread.  With maxDepth set the decisions don't
+// depend on speed, so a faster search must give the same ones.
+class SuiteRunner
+{
+public:
+	SuiteRunner();
+
+	void Run(const PositionSuite& suite, SuiteReport* report);
+
+	double msPerPosition; // wall time, as the report measures it
+	int maxDepth;     // 0 = no limit
+	int numThreads;   // 0 = one per core
+	size_t memoryMB;  // shared by all threads
+};
+
+#endif
@@ -1,135 +1,684 @@
 #include <assert.h>
-#include <time.h>
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <limits>
 #include "search_player.h"
+#include "trace.h"
 
-static const double CPMS = CLOCKS_PER_SEC / 1000.0;
+// Budgets are in wall time: clock() is CPU time over the whole process, so
+// it would run out early once the pool is busy.
+typedef std::chrono::steady_clock Clock;
 
-std::vector<SearchNode*> SearchNode::all;
+static double MSSince(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Serial ExpandMoves probes its table one region of at most RegionBytes at
+// a time, prefetching PrefetchDistance probes ahead.
+static const size_t RegionBytes = 256 * 1024;
+static const size_t PrefetchDistance = 8;
 
-void SearchNode::DeleteAllNodes()
+// Expansion checks the ponderer's stop flag every StopCheckInterval parents
+// (a power of two), or once per chunk in parallel.
+static const uint32_t StopCheckInterval = 1024;
+
+// Parallel expansion hands out parents in chunks of ExpandGrain, and splits
+// the kids of ExpandMovesParallel into NumShards shards by board hash.
+static const size_t ExpandGrain = 1024;
+static const int ShardBits = 6;
+static const int NumShards = 1 << ShardBits;
+
+static inline int ShardOf(uint64_t canonical)
 {
-	const int n = all.size();
-	for(int i=0; i<n; ++i) delete all[i];
-	all.clear();
+	return (int)((canonical * 0x9E3779B97F4A7C15ULL) >> (64 - ShardBits));
 }
 
-TileNodeWrapper::TileNodeWrapper(float p, TileNode *n) : node(n), prob(p) {}
+// Chance nodes weight a 2 by 0.9 and a 4 by 0.1, times the number of cells
+// the spawn stands for, and scale the sum by 1 / (number of open cells), so
+// backup needs no divide.
+static const float InvCells[17] = { 0.0f, 1.0f, 1.0f/2, 1.0f/3, 1.0f/4, 1.0f/5, 1.0f/6,
+	1.0f/7, 1.0f/8, 1.0f/9, 1.0f/10, 1.0f/11, 1.0f/12, 1.0f/13, 1.0f/14, 1.0f/15, 1.0f/16 };
 
-MoveNode* MoveNode::New()
+// Leaf evaluation into node values, through a float buffer when they're
+// compact.
+static inline void EvalLeaves(EvalCache& cache, const uint64_t* boards, const int* gameScores,
+	size_t n, float* out, byte* dead = nullptr)
+{
+	cache.Eval(boards, gameScores, n, out, dead);
+}
+static inline void EvalLeaves(EvalCache& cache, const uint64_t* boards, const int* gameScores,
+	size_t n, CompactScore* out, byte* dead = nullptr)
 {
-	MoveNode* node = new MoveNode;
-	all.push_back(node);
-	return node;
+	const size_t BatchSize = 256;
+	float values[BatchSize];
+	for(size_t i=0; i<n; i+=BatchSize){
+		const size_t m = std::min(BatchSize, n - i);
+		cache.Eval(boards + i, gameScores + i, m, values, dead != nullptr ? dead + i : nullptr);
+		for(size_t j=0; j<m; ++j) out[i+j] = PackScore(values[j]);
+	}
 }
 
-TileNode* TileNode::New()
+void SearchStats::Reset()
 {
-	TileNode* node = new TileNode;
-	all.push_back(node);
-	return node;
+	nodes = 0;
+	peakBytes = 0;
+	moveDepth = 0;
+	ms = 0.0;
+	expandMS = 0.0;
+	backupMS = 0.0;
+	evalHits = 0;
+	evalMisses = 0;
+	bBudgetHit = false;
+	bForced = false;
+	bExtended = false;
+	bDecided = false;
+	bBook = false;
+	bPondered = false;
+	for(int i=0; i<NumDirections; ++i){
+		rootScore[i] = -std::numeric_limits<float>::infinity();
+		rootProbDeath[i] = 1.0f;
+	}
 }
 
-TileNode::TileNode()
+SearchPlayer::SearchPlayer(ThreadPool* pool_)
+	: book(nullptr), maxMoveDepth(99), maxNodes(std::numeric_limits<size_t>::max()),
+	  parallelExpandMin(1 << 14), peakBytes(0), bVerbose(true), pool(pool_), dedupBytes(0),
+	  nodesAbove(0), bStopPonder(false),
+	  stopFlag(nullptr)
 {
-	for(int i=0; i<NumDirections; ++i)
-		kids[i] = nullptr;
+	if (pool == nullptr) {
+		ownPool.reset(new ThreadPool());
+		pool = ownPool.get();
+	}
+	SetMemoryBudget(1024);
+	SetEvalCacheSize(1 << 14); // 256KB per thread, to stay in L2
 }
 
-bool TileNode::IsDupBoard(const Board& b) const
+SearchPlayer::~SearchPlayer()
 {
-	for(int i=0; i<NumDirections; ++i){
-		if (kids[i] == nullptr) continue;
-		if (b == kids[i]->board.GetCanonical()) return true;
+	StopPondering();
+}
+
+void SearchPlayer::NewGame()
+{
+	StopPondering();
+	ponderMoves.clear();
+	timeManager.NewGame();
+}
+
+void SearchPlayer::SetPondering(bool bOn)
+{
+	StopPondering();
+	ponderMoves.clear();
+	if (!bOn) {
+		ponderer.reset();
+		return;
+	}
+	ponderer.reset(new SearchPlayer(pool));
+	ponderer->bVerbose = false;
+	ponderer->stopFlag = &bStopPonder;
+}
+
+void SearchPlayer::StopPondering()
+{
+	if (!ponderThread.joinable()) return;
+	bStopPonder = true;
+	ponderThread.join();
+	bStopPonder = false;
+}
+
+void SearchPlayer::FinishPondering()
+{
+	if (ponderThread.joinable()) ponderThread.join();
+}
+
+// Searches each spawn outcome of afterMove, most likely first, and records
+// the moves of the searches that finish before StopPondering.
+void SearchPlayer::StartPondering(const Board& afterMove)
+{
+	ponderMoves.clear();
+	ponderer->timeManager = timeManager;
+	ponderer->timeManager.gameBudgetMS = 0.0;
+	ponderer->maxMoveDepth = maxMoveDepth;
+	ponderer->maxNodes = maxNodes;
+	ponderer->maxBytes = maxBytes;
+	ponderer->book = book;
+
+	ponderThread = std::thread([this, afterMove]() {
+		byte avail[16];
+		const int nAvail = afterMove.GetAvailableTiles(avail);
+		for(int tile=1; tile<=2; ++tile){
+			for(int i=0; i<nAvail; ++i){
+				Board b = afterMove;
+				b.SetCell(avail[i], (ushort)tile);
+				const Direction move = ponderer->FindBestMove(b);
+				if (bStopPonder) return;
+				ponderMoves[b.Bits()] = move;
+			}
+		}
+	});
+}
+
+
+void SearchPlayer::SetMemoryBudget(size_t mb)
+{
+	maxBytes = mb << 20;
+}
+
+void SearchPlayer::SetEvalCacheSize(size_t numEntries)
+{
+	evalCaches.resize(pool->NumThreads());
+	for(size_t i=0; i<evalCaches.size(); ++i)
+		evalCaches[i].Resize(numEntries);
+}
+
+// Memory used by the tree plus the dedup maps.
+size_t SearchPlayer::MemoryUsed() const
+{
+	return tree.NumBytes() + moveNodes.Bytes() + dedupBytes;
+}
+
+// Whether an expansion may hold this many bytes in all.  The root's moves
+// are exempt, as in MakeRoom.
+bool SearchPlayer::FitsBudget(size_t bytes) const
+{
+	return IsRootExpansion() || bytes <= maxBytes;
+}
+
+// Frees the dedup buffers of ExpandMoves, so their memory isn't held (and
+// counted) while the next plies are built.
+void SearchPlayer::ReleaseScratch()
+{
+	PageVector<ExpandCandidate>().swap(candidates);
+	PageVector<ExpandCandidate>().swap(partitioned);
+	moveNodes.Reset(0);
+	std::vector<ExpandShard>().swap(expandShards);
+	std::vector<NodeTable>().swap(shardNodes);
+	std::vector<std::vector<uint64_t> >().swap(shardOwners);
+	dedupBytes = 0;
+}
+
+size_t SearchPlayer::ExpandShard::Bytes() const
+{
+	return index.Bytes() + canonical.capacity() * sizeof(uint64_t) + board.capacity() * sizeof(uint64_t)
+		+ gameScore.capacity() * sizeof(int) + firstSlot.capacity() * sizeof(uint32_t)
+		+ node.capacity() * sizeof(uint32_t) + refs.capacity() * sizeof(refs[0]);
+}
+
+// Makes sure n more nodes fit in the ply without going over budget.
+// The ply grows geometrically, but never past what the budget allows.
+// The root's moves (at most four nodes) are exempt, so a search always
+// has a move to pick however small the budget.
+template<class Ply>
+bool SearchPlayer::MakeRoom(Ply& ply, size_t otherBytes, size_t n)
+{
+	const size_t size = ply.Size() + n;
+	const bool bRoot = IsRootExpansion();
+	if (!bRoot && nodesAbove + size > maxNodes) return false;
+	if (!bRoot && otherBytes + size * Ply::NodeBytes > maxBytes) return false;
+	if (size <= ply.Capacity()) {
+		if (bRoot || otherBytes + ply.Bytes() <= maxBytes) return true;
+		// The buffer kept from an earlier search is more than the budget
+		// allows next to the rest; free it to regrow within the budget.
+		if (ply.Size() > 0) return false;
+		ply = Ply();
 	}
+
+	size_t capacity = std::max(size, std::max((size_t)1024, 2 * ply.Capacity()));
+	if (!bRoot && otherBytes + capacity * Ply::NodeBytes > maxBytes)
+		capacity = (maxBytes - otherBytes) / Ply::NodeBytes;
+	ply.Reserve(capacity);
+	// Fresh pages, spread over the workers' NUMA nodes before the ply
+	// is filled.
+	if (pool->NumThreads() > 1) ply.FirstTouch(pool);
+	return true;
+}
+
+// Undo a partly built move ply k or tile ply k+1, leaving the tree as it
+// was before the expansion.  Both return false, for the expansion to return.
+bool SearchPlayer::DropMovePly(int k)
+{
+	ReleaseScratch();
+	tree.PopMovePly();
+	TilePly& tiles = tree.Tiles(k);
+	std::fill(tiles.kids.begin(), tiles.kids.end(), NoKid);
 	return false;
 }
 
-Direction SearchPlayer::FindBestMove(const Board& board)
+bool SearchPlayer::DropTilePly(int k)
 {
-	clock_t start = clock();  
-	MoveNodeMap moveNodes;
-	std::vector<TileNode*> tileNodes;
+	tree.PopTilePly();
+	MovePly& moves = tree.Moves(k);
+	std::fill(moves.numKids.begin(), moves.numKids.end(), 0);
+	return false;
+}
 
-	std::vector< std::pair<int,float> > random_tile_info;
-	random_tile_info.push_back(std::make_pair<int,float>(1,0.9f));
-	random_tile_info.push_back(std::make_pair<int,float>(2,0.1f));
+// Adds move ply k holding the kids of tile ply k.  Kids that are equivalent
+// (same canonical board) to a sibling are dropped, and equivalent boards
+// anywhere in the ply share one node.  Returns false, with the tree left as
+// it was, if the memory budget would be exceeded.  The dedup buffers count
+// against the budget too, checked before they grow, and are freed once the
+// ply is built.
+bool SearchPlayer::ExpandMoves(int k)
+{
+	if (pool->NumThreads() > 1 && tree.Tiles(k).Size() >= parallelExpandMin)
+		return ExpandMovesParallel(k);
 
-	TileNode *root = TileNode::New();
-	root->board = board;
-	tileNodes.push_back(root);
+	TRACE_SCOPE("ExpandMoves");
+	MovePly& moves = tree.AddMovePly();
+	TilePly& tiles = tree.Tiles(k);
+	nodesAbove = tree.NumNodes();
+	const size_t treeBytes = tree.NumBytes() - moves.Bytes();
 
-	Direction dirs[4];
-	byte avail[16];
-	const int MaxMoveDepth = 99;
-	const int MaxMS = 30;
-	int moveDepth = 0;
-	for(int iMove=0; iMove < MaxMoveDepth; ++iMove) {
-		moveNodes.clear();
-		for(unsigned int iNode=0; iNode<tileNodes.size(); ++iNode) {
-			TileNode* node = tileNodes[iNode];
-			int nDirs = node->board.GetLegalMoves(dirs);
-			for(int i=0; i<nDirs; ++i){
-				Direction dir = dirs[i];
-				Board b = node->board;
-				b.Slide(dir);
-				Board canonical = b.GetCanonical();
-				if (node->IsDupBoard(canonical)) continue;
-
-				MoveNodeMap::iterator it = moveNodes.find(canonical);
-				if (it == moveNodes.end()) {
-					MoveNode *kid = MoveNode::New();
-					kid->board = b;
-					node->kids[dir] = kid;
-					moveNodes.insert(std::make_pair<Board,MoveNode*>(canonical, kid));
-				} else {
-					node->kids[dir] = it->second;
+	// Probing the table in kid order would miss the cache on nearly every
+	// probe of a big ply.  Instead every kid's canonical board is generated
+	// first, the table is sized for them, and the kids are partitioned (a
+	// stable counting sort) by the top bits of their hash so that each
+	// partition probes a region of the table about the size of L2, with
+	// prefetches a few kids ahead.  The partitions keep kid order, so the
+	// kid that makes a node is the first, as with a probe per kid; its board
+	// is regenerated from its parent.
+	candidates.clear();
+	Board succ[NumDirections];
+	for(uint32_t i=0; i<tiles.Size(); ++i){
+		if ((i & (StopCheckInterval-1)) == 0 && IsStopped()) return DropMovePly(k);
+		const Board node = tiles.GetBoard(i);
+		uint64_t siblings[4];
+		int nSiblings = 0;
+		const int legal = node.GenerateMoves(succ);
+		for(int dir=0; dir<NumDirections; ++dir){
+			if ((legal & (1 << dir)) == 0) continue;
+			const uint64_t canonical = succ[dir].GetCanonical().Bits();
+			if (std::find(siblings, siblings + nSiblings, canonical) != siblings + nSiblings) continue;
+			siblings[nSiblings++] = canonical;
+
+			if (candidates.size() == candidates.capacity()) {
+				// Grown by hand so the budget is checked first, counting the old
+				// buffer that is held while the new one is filled.
+				const size_t capacity = std::max((size_t)1024, 2 * candidates.capacity());
+				if (!FitsBudget(treeBytes + (capacity + candidates.capacity()) * sizeof(ExpandCandidate)))
+					return DropMovePly(k);
+				candidates.reserve(capacity);
+			}
+			ExpandCandidate c;
+			c.canonical = canonical;
+			c.hash = NodeTable::Hash(canonical);
+			c.slot = NumDirections*i + dir;
+			candidates.push_back(c);
+		}
+	}
+
+	const size_t n = candidates.size();
+	if (!FitsBudget(treeBytes + (candidates.capacity() + n) * sizeof(ExpandCandidate) + NodeTable::BytesFor(n)))
+		return DropMovePly(k);
+	moveNodes.Reset(n);
+	int partBits = 0;
+	while(partBits < moveNodes.SlotBits() && (moveNodes.Bytes() >> partBits) > RegionBytes) ++partBits;
+	const int partShift = 64 - partBits;
+	partStart.assign(((size_t)1 << partBits) + 1, 0);
+	for(size_t j=0; j<n; ++j)
+		++partStart[partBits == 0 ? 1 : (candidates[j].hash >> partShift) + 1];
+	for(size_t p=1; p<partStart.size(); ++p) partStart[p] += partStart[p-1];
+	partitioned.reserve(n);
+	partitioned.resize(n);
+	for(size_t j=0; j<n; ++j)
+		partitioned[partStart[partBits == 0 ? 0 : candidates[j].hash >> partShift]++] = candidates[j];
+	dedupBytes = (candidates.capacity() + partitioned.capacity()) * sizeof(ExpandCandidate);
+
+	TRACE_COUNT("NodeTable.Insert", n);
+	for(size_t j=0; j<n; ++j){
+		if ((j & (StopCheckInterval-1)) == 0 && IsStopped()) return DropMovePly(k);
+		if (j + PrefetchDistance < n) moveNodes.Prefetch(partitioned[j + PrefetchDistance].hash);
+		const ExpandCandidate& c = partitioned[j];
+		bool bInserted;
+		const uint32_t kid = moveNodes.Insert(c.canonical, c.hash, (uint32_t)moves.Size(), &bInserted);
+		if (bInserted) {
+			if (!MakeRoom(moves, treeBytes + moveNodes.Bytes() + dedupBytes, 1)) {
+				return DropMovePly(k);
+			}
+			Board b = tiles.GetBoard(c.slot / NumDirections);
+			b.Slide((Direction)(c.slot % NumDirections));
+			moves.Add(b.Bits(), b.score);
+		}
+		tiles.kids[c.slot] = kid;
+	}
+	stats.peakBytes = std::max(stats.peakBytes, MemoryUsed());
+	ReleaseScratch();
+	return true;
+}
+
+// Adds tile ply k+1 holding the kids of move ply k.  Returns false, with the
+// tree left as it was, if the memory budget would be exceeded.
+bool SearchPlayer::ExpandTiles(int k)
+{
+	if (pool->NumThreads() > 1 && tree.Moves(k).Size() >= parallelExpandMin)
+		return ExpandTilesParallel(k);
+
+	TRACE_SCOPE("ExpandTiles");
+	TilePly& tiles = tree.AddTilePly();
+	MovePly& moves = tree.Moves(k);
+	nodesAbove = tree.NumNodes();
+	const size_t otherBytes = MemoryUsed() - tiles.Bytes();
+
+	byte cells[16], weights[16];
+	for(uint32_t i=0; i<moves.Size(); ++i){
+		if ((i & (StopCheckInterval-1)) == 0 && IsStopped()) return DropTilePly(k);
+		const uint64_t b = moves.board[i];
+		const int gameScore = moves.gameScore[i];
+		int nCells = moves.GetBoard(i).GetSpawnCells(cells, weights);
+		if (!MakeRoom(tiles, otherBytes, 2*nCells)) {
+			return DropTilePly(k);
+		}
+		moves.firstKid[i] = (uint32_t)tiles.Size();
+		moves.numKids[i] = (byte)(2*nCells);
+		for(int j=0; j<nCells; ++j){
+			const int shift = 4 * cells[j];
+			tiles.Add(b | (1ULL << shift), gameScore, weights[j]);
+			tiles.Add(b | (2ULL << shift), gameScore, weights[j]);
+		}
+	}
+	stats.peakBytes = std::max(stats.peakBytes, MemoryUsed());
+	return true;
+}
+
+// ExpandMoves split across the pool, building the same ply up to the order
+// of its nodes.  Each thread files the kids of its parents into its own
+// shards, deduplicating as it goes; then each shard merges its candidates
+// from all threads, keeping the one first in parent order as the serial
+// loop would; then the shards are laid out one after another in the ply.
+// The budget covers the shard buffers as they fill, and the ply once its
+// size is known.
+bool SearchPlayer::ExpandMovesParallel(int k)
+{
+	TRACE_SCOPE("ExpandMovesParallel");
+	MovePly& moves = tree.AddMovePly();
+	TilePly& tiles = tree.Tiles(k);
+	moveNodes.Reset(0);
+	nodesAbove = tree.NumNodes();
+	const size_t treeBytes = tree.NumBytes() - moves.Bytes();
+	const int nThreads = pool->NumThreads();
+	expandShards.resize(nThreads * NumShards);
+	shardNodes.resize(NumShards);
+	shardOwners.resize(NumShards);
+
+	// The buffers grow as they're filled, so their memory is claimed from the
+	// budget after each chunk or shard, and every thread gives up once the
+	// claims go over.  That overshoots by at most what one chunk or shard
+	// adds per thread.
+	const size_t scratchLimit = IsRootExpansion() ? std::numeric_limits<size_t>::max()
+		: maxBytes - std::min(maxBytes, treeBytes + moveNodes.Bytes());
+	std::atomic<size_t> scratchBytes(0);
+	for(size_t i=0; i<expandShards.size(); ++i) scratchBytes += expandShards[i].Bytes();
+	for(int s=0; s<NumShards; ++s) scratchBytes += shardNodes[s].Bytes();
+	std::atomic<bool> bOverBudget(scratchBytes > scratchLimit);
+	auto claim = [&](size_t before, size_t after) {
+		if (after > before && (scratchBytes += after - before) > scratchLimit) bOverBudget = true;
+	};
+
+	// Chunks reach each thread in increasing order, so a thread's first
+	// candidate for a board has its lowest slot.
+	pool->ParallelFor(tiles.Size(), ExpandGrain, [&](size_t begin, size_t end, int iThread) {
+		if (IsStopped() || bOverBudget) return;
+		ExpandShard* shards = &expandShards[iThread * NumShards];
+		size_t before = 0;
+		for(int s=0; s<NumShards; ++s) before += shards[s].Bytes();
+		Board succ[NumDirections];
+		for(size_t i=begin; i<end; ++i){
+			const Board node = tiles.GetBoard((uint32_t)i);
+			uint64_t siblings[4];
+			int nSiblings = 0;
+			const int legal = node.GenerateMoves(succ);
+			for(int dir=0; dir<NumDirections; ++dir){
+				if ((legal & (1 << dir)) == 0) continue;
+				const Board& b = succ[dir];
+				const uint64_t canonical = b.GetCanonical().Bits();
+				if (std::find(siblings, siblings + nSiblings, canonical) != siblings + nSiblings) continue;
+				siblings[nSiblings++] = canonical;
+
+				ExpandShard& shard = shards[ShardOf(canonical)];
+				const uint32_t slot = (uint32_t)(NumDirections*i + dir);
+				bool bInserted;
+				const uint32_t cand = shard.index.Insert(canonical, (uint32_t)shard.board.size(), &bInserted);
+				if (bInserted) {
+					shard.canonical.push_back(canonical);
+					shard.board.push_back(b.Bits());
+					shard.gameScore.push_back(b.score);
+					shard.firstSlot.push_back(slot);
 				}
+				shard.refs.push_back(std::make_pair(slot, cand));
 			}
 		}
-		++moveDepth;
-		if ((clock() - start)/CPMS >= MaxMS) break;    
-
-		//printf("Move: %d  MoveNodes: %lu\n", iMove+1, moveNodes.size());
-		tileNodes.clear();
-		for(MoveNodeMap::iterator it = moveNodes.begin(); it != moveNodes.end(); ++it) {
-			MoveNode* node = it->second;
-			int nAvail = node->board.GetAvailableTiles(avail);
-			random_tile_info[0].second = 0.9f / nAvail;
-			random_tile_info[1].second = 0.1f / nAvail;
-			for(int i=0; i<nAvail; ++i){
-				for(unsigned int j=0; j<random_tile_info.size(); ++j){
-					TileNode *kid = TileNode::New();
-					kid->board = node->board;
-					kid->board.SetCell(avail[i], random_tile_info[j].first);
-          node->kids.push_back(TileNodeWrapper(random_tile_info[j].second, kid));
-					tileNodes.push_back(kid);
+		size_t after = 0;
+		for(int s=0; s<NumShards; ++s) after += shards[s].Bytes();
+		claim(before, after);
+	});
+
+	if (IsStopped() || bOverBudget) return DropMovePly(k);
+
+	pool->ParallelFor(NumShards, 1, [&](size_t begin, size_t end, int) {
+		for(size_t s=begin; s<end && !bOverBudget; ++s){
+			NodeTable& nodes = shardNodes[s];
+			std::vector<uint64_t>& owners = shardOwners[s];
+			size_t before = nodes.Bytes() + owners.capacity() * sizeof(uint64_t);
+			for(int t=0; t<nThreads; ++t){
+				ExpandShard& shard = expandShards[t * NumShards + s];
+				before += shard.node.capacity() * sizeof(uint32_t);
+				shard.node.resize(shard.board.size());
+				for(uint32_t c=0; c<shard.board.size(); ++c){
+					bool bInserted;
+					const uint32_t node = nodes.Insert(shard.canonical[c], (uint32_t)owners.size(), &bInserted);
+					const uint64_t owner = ((uint64_t)t << 32) | c;
+					if (bInserted) {
+						owners.push_back(owner);
+					} else {
+						uint64_t& best = owners[node];
+						const ExpandShard& bestShard = expandShards[(best >> 32) * NumShards + s];
+						if (shard.firstSlot[c] < bestShard.firstSlot[(uint32_t)best]) best = owner;
+					}
+					shard.node[c] = node;
 				}
 			}
+			size_t after = nodes.Bytes() + owners.capacity() * sizeof(uint64_t);
+			for(int t=0; t<nThreads; ++t)
+				after += expandShards[t * NumShards + s].node.capacity() * sizeof(uint32_t);
+			claim(before, after);
 		}
-		//printf("Move: %d  TileNodes: %lu\n", iMove+1, tileNodes.size());
-		if ((clock() - start)/CPMS >= MaxMS) break;
+	});
+
+	if (bOverBudget) return DropMovePly(k);
+	size_t base[NumShards];
+	size_t total = 0;
+	for(int s=0; s<NumShards; ++s){
+		base[s] = total;
+		total += shardOwners[s].size();
+	}
+	dedupBytes = scratchBytes;
+	if (!MakeRoom(moves, treeBytes + moveNodes.Bytes() + dedupBytes, total)) {
+		return DropMovePly(k);
 	}
+	moves.Resize(total);
 
-	AccumInfo(root);
+	pool->ParallelFor(NumShards, 1, [&](size_t begin, size_t end, int) {
+		for(size_t s=begin; s<end; ++s){
+			const std::vector<uint64_t>& owners = shardOwners[s];
+			for(size_t j=0; j<owners.size(); ++j){
+				const ExpandShard& shard = expandShards[(owners[j] >> 32) * NumShards + s];
+				const uint32_t c = (uint32_t)owners[j];
+				moves.board[base[s] + j] = shard.board[c];
+				moves.gameScore[base[s] + j] = shard.gameScore[c];
+			}
+			for(int t=0; t<nThreads; ++t){
+				const ExpandShard& shard = expandShards[t * NumShards + s];
+				for(size_t r=0; r<shard.refs.size(); ++r)
+					tiles.kids[shard.refs[r].first] = (uint32_t)(base[s] + shard.node[shard.refs[r].second]);
+			}
+		}
+	});
+	stats.peakBytes = std::max(stats.peakBytes, MemoryUsed());
+	ReleaseScratch();
+	return true;
+}
 
-	Direction bestDir = None;
-	float bestScore = -std::numeric_limits<float>::infinity();
-	float bestDeath = std::numeric_limits<float>::infinity();
-	for(int i=0; i<NumDirections; ++i){
-		MoveNode* kid = root->kids[i];
-		if (kid == nullptr) continue;
-		//printf("%s: %.1f  %.1f\n", DirName[i], kid->score, kid->probDeath*100.0f);
-	  float deathDiff = kid->probDeath - bestDeath;
-		if (deathDiff <= -0.01
-			|| (fabs(deathDiff) < 0.01 && kid->score > bestScore)) {
-			bestScore = kid->score;
-			bestDeath = kid->probDeath;
-			bestDir = (Direction)i;
+// ExpandTiles split across the pool: count the kids of each parent, lay
+// them out with a prefix sum, then fill them in.
+bool SearchPlayer::ExpandTilesParallel(int k)
+{
+	TRACE_SCOPE("ExpandTilesParallel");
+	TilePly& tiles = tree.AddTilePly();
+	MovePly& moves = tree.Moves(k);
+	nodesAbove = tree.NumNodes();
+	const size_t otherBytes = MemoryUsed() - tiles.Bytes();
+
+	pool->ParallelFor(moves.Size(), ExpandGrain, [&](size_t begin, size_t end, int) {
+		byte cells[16], weights[16];
+		for(size_t i=begin; i<end; ++i)
+			moves.numKids[i] = (byte)(2 * moves.GetBoard((uint32_t)i).GetSpawnCells(cells, weights));
+	});
+	size_t total = 0;
+	for(size_t i=0; i<moves.Size(); ++i){
+		moves.firstKid[i] = (uint32_t)total;
+		total += moves.numKids[i];
+	}
+	if (!MakeRoom(tiles, otherBytes, total)) {
+		return DropTilePly(k);
+	}
+	tiles.Resize(total);
+
+	if (IsStopped()) return DropTilePly(k);
+
+	pool->ParallelFor(moves.Size(), ExpandGrain, [&](size_t begin, size_t end, int) {
+		byte cells[16], weights[16];
+		for(size_t i=begin; i<end; ++i){
+			const uint64_t b = moves.board[i];
+			const int nCells = moves.GetBoard((uint32_t)i).GetSpawnCells(cells, weights);
+			uint32_t kid = moves.firstKid[i];
+			for(int j=0; j<nCells; ++j){
+				const int shift = 4 * cells[j];
+				tiles.board[kid] = b | (1ULL << shift);
+				tiles.gameScore[kid] = moves.gameScore[i];
+				tiles.weight[kid++] = weights[j];
+				tiles.board[kid] = b | (2ULL << shift);
+				tiles.gameScore[kid] = moves.gameScore[i];
+				tiles.weight[kid++] = weights[j];
+			}
+		}
+	});
+	stats.peakBytes = std::max(stats.peakBytes, MemoryUsed());
+	return true;
+}
+
+Direction SearchPlayer::FindBestMove(const Board& board)
+{
+	stats.Reset();
+	Direction move = None;
+	if (ponderer) {
+		StopPondering();
+		std::unordered_map<uint64_t, Direction>::const_iterator it = ponderMoves.find(board.Bits());
+		if (it != ponderMoves.end()) {
+			move = it->second;
+			stats.bPondered = true;
+		}
+	}
+	if (!stats.bPondered) move = Search(board);
+	if (ponderer && move != None) {
+		Board b = board;
+		b.Slide(move);
+		StartPondering(b);
+	}
+	return move;
+}
+
+Direction SearchPlayer::Search(const Board& board)
+{
+	TRACE_SCOPE("FindBestMove");
+	const Clock::time_point start = Clock::now();
+	for(size_t i=0; i<evalCaches.size(); ++i)
+		evalCaches[i].ResetCounts();
+
+	Direction dirs[4];
+	const int nLegal = board.GetLegalMoves(dirs);
+	timeManager.StartMove(board, nLegal);
+	if (timeManager.IsForced()) {
+		stats.bForced = true;
+		return nLegal == 1 ? dirs[0] : None;
+	}
+	if (book != nullptr) {
+		const Direction move = book->Lookup(board);
+		if (move != None) {
+			stats.bBook = true;
+			return move;
 		}
 	}
-	
-	printf("Nodes: %lu    move depth: %d\n", SearchNode::all.size(), moveDepth);
-	SearchNode::DeleteAllNodes();
+
+	tree.Clear();
+	tree.AddTilePly().Add(board.Bits(), board.score);
+
+	// The memory budget is checked before each node is created.  If it would be
+	// exceeded, the partial ply is dropped so the search ends on the deepest
+	// fully expanded ply.
+	int moveDepth = 0;
+	for(int iMove=0; iMove < maxMoveDepth; ++iMove) {
+		Clock::time_point expandStart = Clock::now();
+		const bool bMoves = ExpandMoves(iMove);
+		stats.expandMS += MSSince(expandStart);
+		if (!bMoves) {
+			stats.bBudgetHit = !IsStopped();
+			break;
+		}
+		++moveDepth;
+		if (!KeepSearching(MSSince(start))) break;
+
+		//printf("Move: %d  MoveNodes: %lu\n", iMove+1, tree.Moves(iMove).Size());
+		expandStart = Clock::now();
+		const bool bTiles = ExpandTiles(iMove);
+		stats.expandMS += MSSince(expandStart);
+		if (!bTiles) {
+			stats.bBudgetHit = !IsStopped();
+			break;
+		}
+		//printf("Move: %d  TileNodes: %lu\n", iMove+1, tree.Tiles(iMove+1).Size());
+		if (!KeepSearching(MSSince(start))) break;
+	}
+
+	// A stopped ponder search is thrown away; don't spend a backup on it.
+	if (IsStopped()) return None;
+
+	Backup();
+	Direction bestDir = PickRootMove(nullptr, nullptr);
+	assert(bestDir != None);
+	Board succ[NumDirections];
+	const int legal = board.GenerateMoves(succ);
+	const uint32_t* rootKids = &tree.Tiles(0).kids[0];
+	for(int i=0; i<NumDirections; ++i){
+		uint32_t kid = rootKids[i];
+		// A move equivalent to an earlier sibling has no node of its own.
+		for(int j=0; kid == NoKid && (legal & (1 << i)) && j<i; ++j)
+			if (rootKids[j] != NoKid && succ[j].GetCanonical().Bits() == succ[i].GetCanonical().Bits()) kid = rootKids[j];
+		if (kid == NoKid) continue;
+		stats.rootScore[i] = FromScore(tree.Moves(0).score[kid]);
+		stats.rootProbDeath[i] = FromDeath(tree.Moves(0).probDeath[kid]);
+	}
+
+	stats.ms = MSSince(start);
+	timeManager.EndMove(stats.ms);
+	stats.nodes = tree.NumNodes();
+	stats.moveDepth = moveDepth;
+	for(size_t i=0; i<evalCaches.size(); ++i){
+		stats.evalHits += evalCaches[i].hits;
+		stats.evalMisses += evalCaches[i].misses;
+	}
+	TRACE_COUNTER("nodes", stats.nodes);
+	TRACE_COUNTER("moveDepth", moveDepth);
+	TRACE_FLUSH_COUNTS();
+	peakBytes = std::max(peakBytes, stats.peakBytes);
+	if (!bVerbose) return bestDir;
+	printf("Nodes: %lu    move depth: %d    peak: %.1fMB    eval hits: %.0f%%%s\n",
+		stats.nodes, moveDepth, stats.peakBytes / (1024.0 * 1024.0),
+		100.0 * stats.evalHits / std::max(stats.evalHits + stats.evalMisses, (size_t)1),
+		stats.bBudgetHit ? " (budget)" : "");
 
 	if (bestDir != None){
 		Board b = board;
@@ -140,70 +689,192 @@ Direction SearchPlayer::FindBestMove(const Board& board)
 	return bestDir;
 }
 
-void SearchPlayer::AccumInfo(MoveNode *node) const
+// Asks the time manager whether to go another ply.  Once it wants the gaps
+// this backs up the tree built so far to see how far apart the root moves
+// are, so a dominant move stops early and a close call is extended.
+bool SearchPlayer::KeepSearching(double elapsedMS)
 {
-	if (node->accumed) return;
+	if (IsStopped()) return false;
+	if (timeManager.OutOfTime(elapsedMS)) return false;
+	if (!timeManager.WantsGaps(elapsedMS)) return true;
+	TRACE_SCOPE("KeepSearching");
 
-	if (node->kids.empty()){
-		node->score = Eval(node->board);
-		assert(!node->board.IsDead());
-		assert(node->probDeath == 0.0f);
-	} else {
-		assert(node->score == 0.0f);
-		float wsum = 0.0f;
-    for(unsigned int i=0; i<node->kids.size(); ++i){
-			const TileNodeWrapper &wrapper = node->kids[i];
-			AccumInfo(wrapper.node);
-			wsum += wrapper.prob;
-			node->score += wrapper.prob * wrapper.node->score;
-			node->probDeath += wrapper.prob * wrapper.node->probDeath;
-		}
-		node->score /= wsum;
-		node->probDeath /= wsum;
+	Backup();
+	float deathGap, scoreGap;
+	PickRootMove(&deathGap, &scoreGap);
+	const bool bPastSoft = elapsedMS >= timeManager.softMS;
+	if (!timeManager.ShouldContinue(elapsedMS, deathGap, scoreGap)) {
+		stats.bDecided = !bPastSoft;
+		return false;
 	}
-
-	node->accumed = true;
+	stats.bExtended = bPastSoft;
+	return true;
 }
 
-void SearchPlayer::AccumInfo(TileNode *node) const
+// Returns the best root move.  If deathGap/scoreGap are given, they're set to
+// how far the second-best move is behind the best one.
+Direction SearchPlayer::PickRootMove(float* deathGap, float* scoreGap) const
 {
-	if (node->accumed) return;
+	const uint32_t* kids = &tree.Tiles(0).kids[0];
+	const MovePly& moves = tree.Moves(0);
 
-	int nKids = 0;
-	node->score = -std::numeric_limits<float>::infinity();
-	node->probDeath = std::numeric_limits<float>::infinity();
+	Direction bestDir = None;
+	float bestScore = -std::numeric_limits<float>::infinity();
+	float bestDeath = std::numeric_limits<float>::infinity();
 	for(int i=0; i<NumDirections; ++i){
-		MoveNode* kid = node->kids[i];
-		if (kid == nullptr) continue;
-
-		++nKids;
-		AccumInfo(kid);
-		float deathDiff = kid->probDeath - node->probDeath;
+		if (kids[i] == NoKid) continue;
+		const float score = FromScore(moves.score[kids[i]]);
+		const float probDeath = FromDeath(moves.probDeath[kids[i]]);
+		//printf("%s: %.1f  %.1f\n", DirName[i], score, probDeath*100.0f);
+	  float deathDiff = probDeath - bestDeath;
 		if (deathDiff <= -0.01
-			|| (fabs(deathDiff) < 0.01 && kid->score > node->score)) {
-			node->score = kid->score;
-			node->probDeath = kid->probDeath;
+			|| (fabs(deathDiff) < 0.01 && score > bestScore)) {
+			bestScore = score;
+			bestDeath = probDeath;
+			bestDir = (Direction)i;
 		}
 	}
+	if (deathGap == nullptr) return bestDir;
+
+	*deathGap = *scoreGap = std::numeric_limits<float>::infinity();
+	for(int i=0; i<NumDirections; ++i){
+		if (kids[i] == NoKid || i == bestDir) continue;
+		float dd = std::max(0.0f, FromDeath(moves.probDeath[kids[i]]) - bestDeath);
+		float ds = fabs(bestScore - FromScore(moves.score[kids[i]]));
+		if (dd < *deathGap || (dd == *deathGap && ds < *scoreGap)) {
+			*deathGap = dd;
+			*scoreGap = ds;
+		}
+	}
+	return bestDir;
+}
+
+// Computes scores and death probabilities for the whole tree with one
+// bottom-up sweep: each move ply needs only the tile ply below it and each
+// tile ply only the move ply at the same depth.  Nodes within a ply are
+// independent, so each ply is split across the thread pool.
+void SearchPlayer::Backup()
+{
+	TRACE_SCOPE("Backup");
+	const Clock::time_point start = Clock::now();
+	const size_t Grain = 4096;
+	for(int k=tree.NumTilePlies()-1; k>=0 && !IsStopped(); --k){
+		if (k < tree.NumMovePlies()) {
+			pool->ParallelFor(tree.Moves(k).Size(), Grain, [&](size_t begin, size_t end, int iThread) {
+				BackupMoves(k, begin, end, evalCaches[iThread]);
+			});
+		}
+		pool->ParallelFor(tree.Tiles(k).Size(), Grain, [&](size_t begin, size_t end, int iThread) {
+			BackupTiles(k, begin, end, evalCaches[iThread]);
+		});
+	}
+	stats.backupMS += MSSince(start);
+}
 
-	if (nKids == 0) {
-		node->score = Eval(node->board);
-		node->probDeath = (node->board.IsDead() ? 1.0f : 0.0f);
+// Leaves are scored through the thread's eval cache, in contiguous batches
+// when a whole ply is leaves (the deepest plies) and one at a time otherwise.
+void SearchPlayer::BackupMoves(int k, size_t begin, size_t end, EvalCache& cache)
+{
+	TRACE_SCOPE("BackupMoves");
+	MovePly& moves = tree.Moves(k);
+	if (k+1 >= tree.NumTilePlies()) {
+		EvalLeaves(cache, &moves.board[begin], &moves.gameScore[begin], end - begin, &moves.score[begin]);
+		std::fill(moves.probDeath.begin() + begin, moves.probDeath.begin() + end, ToDeath(0.0f));
+		return;
 	}
 
-	node->accumed = true;
+	for(size_t i=begin; i<end; ++i){
+		const int nKids = moves.numKids[i];
+		if (nKids == 0){
+			EvalLeaves(cache, &moves.board[i], &moves.gameScore[i], 1, &moves.score[i]);
+			moves.probDeath[i] = ToDeath(0.0f);
+			assert(!moves.GetBoard(i).IsDead());
+			continue;
+		}
+
+		const TilePly& tiles = tree.Tiles(k+1);
+		const uint32_t first = moves.firstKid[i];
+		// Raw values, scaled once at the end.
+		int nCells = 0;
+		float score = 0.0f, probDeath = 0.0f;
+		for(uint32_t j=first; j<first + nKids; j+=2){
+			const int w = tiles.weight[j];
+			nCells += w;
+			score += w * (0.9f * tiles.score[j] + 0.1f * tiles.score[j+1]);
+			probDeath += w * (0.9f * tiles.probDeath[j] + 0.1f * tiles.probDeath[j+1]);
+		}
+		moves.score[i] = ToScore(FromScore(1) * score * InvCells[nCells]);
+		moves.probDeath[i] = ToDeath(FromDeath(1) * probDeath * InvCells[nCells]);
+	}
 }
 
-float SearchPlayer::Eval(const Board& board, bool bPrint) const
+void SearchPlayer::BackupTiles(int k, size_t begin, size_t end, EvalCache& cache)
 {
-	float a = log((float)board.score);
-	float b = (float)board.MaxTile();
-	float c = (float)board.NumAvailableTiles();
-	float d = (float)board.SmoothnessScore();
-	float e = log(board.CornerScore() / 10.0f + 1.0f);
+	TRACE_SCOPE("BackupTiles");
+	TilePly& tiles = tree.Tiles(k);
+	if (k >= tree.NumMovePlies()) {
+		const size_t BatchSize = 256;
+		byte dead[BatchSize];
+		for(size_t i=begin; i<end; i+=BatchSize){
+			const size_t n = std::min(BatchSize, end - i);
+			EvalLeaves(cache, &tiles.board[i], &tiles.gameScore[i], n, &tiles.score[i], dead);
+			for(size_t j=0; j<n; ++j)
+				tiles.probDeath[i+j] = ToDeath(dead[j] ? 1.0f : 0.0f);
+		}
+		return;
+	}
+
+	for(size_t i=begin; i<end; ++i){
+		int nKids = 0;
+		float score = -std::numeric_limits<float>::infinity();
+		float probDeath = std::numeric_limits<float>::infinity();
+		for(int dir=0; dir<NumDirections; ++dir){
+			const uint32_t kid = tiles.kids[NumDirections*i + dir];
+			if (kid == NoKid) continue;
+
+			++nKids;
+			const MovePly& moves = tree.Moves(k);
+			const float kidScore = FromScore(moves.score[kid]);
+			const float kidDeath = FromDeath(moves.probDeath[kid]);
+			float deathDiff = kidDeath - probDeath;
+			if (deathDiff <= -0.01
+				|| (fabs(deathDiff) < 0.01 && kidScore > score)) {
+				score = kidScore;
+				probDeath = kidDeath;
+			}
+		}
 
-	if (bPrint)
-		printf("Eval: %.3f, %.0f, %.0f, %.0f, %.3f\n", a,b,c,d,e);
+		if (nKids == 0) {
+			byte dead;
+			cache.Eval(&tiles.board[i], &tiles.gameScore[i], 1, &score, &dead);
+			probDeath = (dead ? 1.0f : 0.0f);
+		}
+		tiles.score[i] = ToScore(score);
+		tiles.probDeath[i] = ToDeath(probDeath);
+	}
+}
 
-	return 0.2f*a + 0.3f*b + 0.3f*c - 0.3f*d + 0.5f*e;
-}
\ No newline at end of file
+////////////////////////////////////////////////////////////
+// SearchPlayerSet
+
+SearchPlayerSet::SearchPlayerSet(int numPlayers, size_t memoryMB)
+{
+	for(int i=0; i<numPlayers; ++i){
+		pools.push_back(std::unique_ptr<ThreadPool>(new ThreadPool(1)));
+		players.push_back(std::unique_ptr<SearchPlayer>(new SearchPlayer(pools.back().get())));
+		players.back()->bVerbose = false;
+		players.back()->timeManager.gameBudgetMS = 0.0;
+		players.back()->SetMemoryBudget(std::max((size_t)1, memoryMB / std::max(numPlayers, 1)));
+	}
+}
+
+void SearchPlayerSet::SetBudget(double msPerMove, int maxDepth, bool bFixed)
+{
+	for(size_t i=0; i<players.size(); ++i){
+		TimeManager& tm = players[i]->timeManager;
+		tm.baseMS = msPerMove;
+		tm.maxExtension = (bFixed ? 1.0 : TimeManager().maxExtension);
+		tm.dominanceFraction = (bFixed ? 1.0 : TimeManager().dominanceFraction);
+		players[i]->maxMoveDepth = (maxDepth > 0 ? maxDepth : 99);
+	}
+}
@@ -1,75 +1,201 @@
 #ifndef __SEARCH_PLAYER_H__
 #define __SEARCH_PLAYER_H__
 
-#include <unordered_set>
+#include <math.h>
+#include <stdio.h>
+#include <atomic>
+#include <memory>
+#include <thread>
 #include <unordered_map>
+#include <vector>
+#include "eval_cache.h"
+#include "node_table.h"
+#include "opening_book.h"
 #include "player.h"
+#include "search_tree.h"
+#include "thread_pool.h"
+#include "time_manager.h"
+#include "trace.h"
 
-class SearchNode;
-class MoveNode;
-class TileNode;
-class TileNodeWrapper;
-
-typedef std::unordered_map<Board, MoveNode*> MoveNodeMap;
-typedef std::unordered_map<Board, TileNode*> TileNodeMap;
-typedef std::unordered_map<Board, TileNodeWrapper> TileNodeWrapperMap;
-
-class SearchNode
+// Summary of the most recent search.
+struct SearchStats
 {
-protected:
-	SearchNode() : score(0.0f), probDeath(0.0f), accumed(false) {}
-  virtual ~SearchNode(){}
-
-public:
-	static void DeleteAllNodes();
-
-	Board board;
-	float score;
-	float probDeath;
-	bool accumed;
-
-	static std::vector<SearchNode*> all;
+	SearchStats() { Reset(); }
+	void Reset();
+
+	size_t nodes;
+	size_t peakBytes;
+	int moveDepth;
+	double ms;
+	double expandMS;
+	double backupMS;
+	size_t evalHits;   // leaf evaluations served by the eval caches
+	size_t evalMisses; // leaf evaluations computed
+	bool bBudgetHit; // stopped early because of the memory budget
+	bool bForced;    // only one legal move, no search
+	bool bExtended;  // searched past the soft time budget
+	bool bDecided;   // stopped before the soft time budget on a dominant move
+	bool bBook;      // move came from the opening book
+	bool bPondered;  // move was found while pondering the last one
+
+	// Backed-up values of the root moves, when there was a search; an
+	// illegal move has score -infinity and probDeath 1.
+	float rootScore[NumDirections];
+	float rootProbDeath[NumDirections];
 };
 
-// Board state that results from a move.
-// The next step is to add a random tile.
-class MoveNode : public SearchNode
+class SearchPlayer : public Player
 {
 public:
-	static MoveNode* New();
+	// Backup runs on the given pool; without one the player makes its own
+	// with a thread per core.
+	SearchPlayer(ThreadPool* pool = nullptr);
+	virtual ~SearchPlayer();
+
+	virtual void NewGame();
+	virtual Direction FindBestMove(const Board &board);
 
-  std::vector<TileNodeWrapper> kids;
+	// Leaf evaluation, for Board or any board with the same terms (BoardT).
+	template<class BoardType> static float Eval(const BoardType& board, bool bPrint = false);
+
+	// Sets a hard limit on the memory used by one search.
+	void SetMemoryBudget(size_t mb);
+
+	// Sets the number of entries in each thread's eval cache (0 = no cache).
+	// The caches persist between moves, since leaves repeat from one search
+	// to the next.
+	void SetEvalCacheSize(size_t numEntries);
+
+	// With pondering on, FindBestMove returns its move and then keeps
+	// searching on a background thread: each board the tile spawn can lead
+	// to is searched in turn, 2s (probability 0.9) before 4s.  The next call
+	// stops the pondering and returns at once if its board was already
+	// searched.  Pondering uses this player's pool and a second tree of
+	// the same memory budget.
+	void SetPondering(bool bOn);
+	void StopPondering();
+	void FinishPondering(); // waits until every spawn outcome is searched
+
+	// Where the pages of the last search's tree are, per NUMA node; see
+	// PagesByNode.
+	bool TreePagesByNode(std::vector<size_t>* counts) const { return tree.PagesByNode(counts); }
+
+	TimeManager timeManager;
+	const OpeningBook* book; // consulted before searching, if set
+	int maxMoveDepth;
+	size_t maxNodes;
+	size_t maxBytes;
+	size_t parallelExpandMin; // plies with fewer parents expand on one thread
+
+	SearchStats stats;
+	size_t peakBytes; // highest stats.peakBytes over all searches
+	bool bVerbose;    // print a summary of each search
+
+private:
+	Direction Search(const Board& board);
+	void StartPondering(const Board& afterMove);
+
+	bool IsStopped() const { return stopFlag != nullptr && *stopFlag; }
+	bool DropMovePly(int ply);
+	bool DropTilePly(int ply);
+	bool ExpandMoves(int ply);
+	bool ExpandTiles(int ply);
+	bool ExpandMovesParallel(int ply);
+	bool ExpandTilesParallel(int ply);
+	size_t MemoryUsed() const;
+	bool FitsBudget(size_t bytes) const;
+	void ReleaseScratch();
+	bool IsRootExpansion() const { return tree.NumTilePlies() == 1; } // making the root's moves
+	template<class Ply> bool MakeRoom(Ply& ply, size_t otherBytes, size_t n);
+
+	bool KeepSearching(double elapsedMS);
+	Direction PickRootMove(float* deathGap, float* scoreGap) const;
+	void Backup();
+	void BackupMoves(int ply, size_t begin, size_t end, EvalCache& cache);
+	void BackupTiles(int ply, size_t begin, size_t end, EvalCache& cache);
+
+	ThreadPool* pool;
+	std::unique_ptr<ThreadPool> ownPool;
+	SearchTree tree;
+	NodeTable moveNodes; // canonical board -> node in the move ply being expanded
+
+	// A kid of the tile ply waiting to be deduplicated by ExpandMoves.
+	struct ExpandCandidate
+	{
+		uint64_t canonical;
+		uint64_t hash; // NodeTable::Hash(canonical)
+		uint32_t slot; // in the tile ply's kids[]
+	};
+	PageVector<ExpandCandidate> candidates;  // in kid order
+	PageVector<ExpandCandidate> partitioned; // by table region
+	std::vector<size_t> partStart;
+
+	// Kids of the tile ply found by one thread that fall in one shard (by
+	// hash of the canonical board), one candidate per canonical board.
+	// Used by ExpandMovesParallel.
+	struct ExpandShard
+	{
+		NodeTable index; // canonical board -> candidate
+		std::vector<uint64_t> canonical;
+		std::vector<uint64_t> board;
+		std::vector<int> gameScore;
+		std::vector<uint32_t> firstSlot; // lowest kids[] slot leading to it
+		std::vector<uint32_t> node;      // its node in the shard after the merge
+		std::vector<std::pair<uint32_t, uint32_t> > refs; // (kids[] slot, candidate)
+
+		size_t Bytes() const;
+	};
+	std::vector<ExpandShard> expandShards; // [thread * NumShards + shard]
+	std::vector<NodeTable> shardNodes;     // per shard: canonical board -> node
+	std::vector<std::vector<uint64_t> > shardOwners; // per shard node: thread << 32 | candidate
+	size_t dedupBytes; // dedup buffers of the ExpandMoves under way, besides moveNodes
+	std::vector<EvalCache> evalCaches; // one per pool thread
+	size_t nodesAbove; // nodes in the plies above the one being expanded
+
+	std::unique_ptr<SearchPlayer> ponderer; // searches spawn outcomes
+	std::thread ponderThread;
+	std::atomic<bool> bStopPonder;
+	std::unordered_map<uint64_t, Direction> ponderMoves; // board -> move
+	const std::atomic<bool>* stopFlag; // the ponderer gives up when set
 };
 
-// Board state that results from adding a random tile.
-// The next step is to make a move.
-class TileNode : public SearchNode
+// A SearchPlayer per pool thread, for searching many positions at once.
+// Each player has a one-thread pool of its own, so its backup runs inline,
+// and an equal share of the memory budget.  They print nothing and have no
+// game budget.
+class SearchPlayerSet
 {
 public:
-	static TileNode* New();
+	SearchPlayerSet(int numPlayers, size_t memoryMB);
 
-	TileNode();
-	bool IsDupBoard(const Board& b) const;
+	// Each search stops after about msPerMove, in wall time however many
+	// players search at once, or maxDepth moves deep if maxDepth > 0.  A
+	// fixed budget is spent in full: no extension for close moves and no
+	// early stop on a dominant one.
+	void SetBudget(double msPerMove, int maxDepth = 0, bool bFixed = false);
 
-	MoveNode* kids[4];
-};
-
-class TileNodeWrapper
-{
-public:
-	TileNodeWrapper(float prob, TileNode *node);
+	int Size() const { return (int)players.size(); }
+	SearchPlayer& operator[](int i) { return *players[i]; }
 
-	TileNode *node;
-	float prob;
+private:
+	std::vector<std::unique_ptr<ThreadPool> > pools;
+	std::vector<std::unique_ptr<SearchPlayer> > players;
 };
 
-class SearchPlayer : public Player
+template<class BoardType>
+float SearchPlayer::Eval(const BoardType& board, bool bPrint)
 {
-	virtual Direction FindBestMove(const Board &board);
+	TRACE_COUNT("Eval", 1);
+	float a = log((float)board.score);
+	float b = (float)board.MaxTile();
+	float c = (float)board.NumAvailableTiles();
+	float d = (float)board.SmoothnessScore();
+	float e = log(board.CornerScore() / 10.0f + 1.0f);
 
-	void AccumInfo(MoveNode *node) const;
-	void AccumInfo(TileNode *node) const;
-	float Eval(const Board& board, bool bPrint = false) const;
-};
+	if (bPrint)
+		printf("Eval: %.3f, %.0f, %.0f, %.0f, %.3f\n", a,b,c,d,e);
+
+	return 0.2f*a + 0.3f*b + 0.3f*c - 0.3f*d + 0.5f*e;
+}
 
-#endif
\ No newline at end of file
+#endif
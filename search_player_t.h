@@ -0,0 +1,290 @@
+#ifndef __SEARCH_PLAYER_T_H__
+#define __SEARCH_PLAYER_T_H__
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+#include "board_t.h"
+#include "search_player.h"
+#include "time_manager.h"
+
+// Boards that score alike share a cache entry.  Board knows its canonical
+// form cheaply; other boards are their own key.
+template<class BoardType>
+inline BoardType CacheKey(const BoardType& board) { return board; }
+inline Board CacheKey(const Board& board) { return board.GetCanonical(); }
+
+// Depth-first expectimax for any BoardType, on an explicit stack so that it
+// advances one node per Step: the caller can check a clock, or yield, between
+// steps.  Scored chance nodes are cached per moves left.  A score depends
+// only on the board and the moves left, so the caches carry over from one
+// root and one depth to the next until Clear; a score that is given up on
+// is never cached.
+template<class BoardType>
+class ExpectimaxT
+{
+public:
+	ExpectimaxT() : maxBytes(std::numeric_limits<size_t>::max()), nodes(0), bBudgetHit(false), nEntries(0), value(0.0f) {}
+
+	// Starts scoring afterMove, a board after a move, with depth moves left
+	// below it.  Step until it returns false; then Value is its score.
+	void Start(const BoardType& afterMove, int depth)
+	{
+		if ((int)cache.size() < depth) cache.resize(depth);
+		stack.clear();
+		Frame root;
+		root.board = afterMove;
+		root.depth = depth;
+		root.bChance = true;
+		if (Open(&root, &value)) stack.push_back(root);
+	}
+
+	// Visits one node.  Returns true while the score is unfinished.
+	bool Step()
+	{
+		if (stack.empty()) return false;
+		++nodes;
+		Frame child;
+		float v;
+		if (NextChild(&stack.back(), &child)) {
+			if (Open(&child, &v)) stack.push_back(child);
+			else AddChild(&stack.back(), v);
+		} else {
+			v = Finish(&stack.back());
+			stack.pop_back();
+			if (stack.empty()) value = v;
+			else AddChild(&stack.back(), v);
+		}
+		return !stack.empty();
+	}
+
+	float Value() const { return value; }
+
+	// Drops the caches and any unfinished score.
+	void Clear()
+	{
+		cache.clear();
+		stack.clear();
+		nEntries = 0;
+		nodes = 0;
+		bBudgetHit = false;
+	}
+
+	// Leaf value, SearchPlayer's evaluation; a score of 0 counts as 1, as
+	// the evaluation takes its log.
+	static float Eval(const BoardType& board)
+	{
+		BoardType b = board;
+		b.score = std::max(b.score, (decltype(b.score))1);
+		return SearchPlayer::Eval(b);
+	}
+
+	// Score of a board with no moves; far below any live board.
+	static float DeadScore() { return -1000.0f; }
+
+	size_t maxBytes; // the caches stop growing here
+	size_t nodes;    // visited since Clear
+	bool bBudgetHit; // the caches filled maxBytes
+
+private:
+	typedef std::unordered_map<BoardType, float> Cache;
+
+	// A cache entry with its hash node and bucket.
+	static const size_t EntryBytes = sizeof(typename Cache::value_type) + 3 * sizeof(void*);
+
+	// A node on the stack.  Chance nodes are boards after a move, move nodes
+	// boards after a tile spawn; depth is the number of moves left below.
+	struct Frame
+	{
+		BoardType board;
+		BoardType key;  // chance nodes only
+		int depth;
+		int next;       // next child: a direction, or 2 * open cell index + (tile is a 4)
+		int nCells;
+		byte cells[BoardType::NumCells];
+		float value;
+		bool bChance;
+	};
+
+	// Gets a node ready to visit its children, or returns false with *v set
+	// if it needs none.
+	bool Open(Frame* f, float* v)
+	{
+		f->next = 0;
+		if (!f->bChance) {
+			f->value = DeadScore();
+			return true;
+		}
+		if (f->depth <= 0) {
+			*v = Eval(f->board);
+			return false;
+		}
+		f->key = CacheKey(f->board);
+		typename Cache::const_iterator it = cache[f->depth-1].find(f->key);
+		if (it != cache[f->depth-1].end()) {
+			*v = it->second;
+			return false;
+		}
+		f->nCells = f->board.GetAvailableTiles(f->cells);
+		f->value = 0.0f;
+		return true;
+	}
+
+	// Sets up the next child of f, or returns false when there are no more.
+	static bool NextChild(Frame* f, Frame* child)
+	{
+		if (f->bChance) {
+			if (f->next >= 2 * f->nCells) return false;
+			child->board = f->board;
+			child->board.SetCell(f->cells[f->next / 2], (f->next & 1) ? 2 : 1);
+			child->depth = f->depth;
+			child->bChance = false;
+			++f->next;
+			return true;
+		}
+		while(f->next < NumDirections){
+			BoardType b = f->board;
+			if (!b.Slide((Direction)f->next++)) continue;
+			child->board = b;
+			child->depth = f->depth - 1;
+			child->bChance = true;
+			return true;
+		}
+		return false;
+	}
+
+	// Folds in the value of the child NextChild last set up: a 2 spawns with
+	// probability 0.9 and a 4 with 0.1.
+	static void AddChild(Frame* f, float v)
+	{
+		if (f->bChance)
+			f->value += ((f->next - 1) & 1 ? 0.1f : 0.9f) * v;
+		else
+			f->value = std::max(f->value, v);
+	}
+
+	float Finish(Frame* f)
+	{
+		if (!f->bChance) return f->value;
+		const float v = (f->nCells > 0 ? f->value / f->nCells : Eval(f->board));
+		if ((nEntries + 1) * EntryBytes > maxBytes) {
+			bBudgetHit = true;
+			return v;
+		}
+		cache[f->depth-1][f->key] = v;
+		++nEntries;
+		return v;
+	}
+
+	std::vector<Cache> cache; // [moves left - 1]
+	std::vector<Frame> stack;
+	size_t nEntries;          // over all the caches
+	float value;
+};
+
+// Expectimax player for any BoardT.  SearchPlayer stays the tuned player for
+// the 4x4 game; this one runs ExpectimaxT, deepened one move at a time.  It
+// shares SearchPlayer's evaluation and budgets: a TimeManager decides whether
+// to go a move deeper (a depth cut off by the hard budget is thrown away),
+// and the caches stop growing at the memory budget.
+template<class BoardType>
+class SearchPlayerT
+{
+public:
+	SearchPlayerT(int maxMoveDepth_ = 99)
+		: maxMoveDepth(maxMoveDepth_), nodes(0), moveDepth(0), ms(0.0), bBudgetHit(false)
+	{
+		SetMemoryBudget(256);
+	}
+
+	void NewGame() { timeManager.NewGame(); }
+
+	// Sets a hard limit on the memory used by the caches of one search.
+	void SetMemoryBudget(size_t mb) { maxBytes = mb << 20; }
+
+	Direction FindBestMove(const BoardType& board)
+	{
+		start = Clock::now();
+		moveDepth = 0;
+		search.Clear();
+		search.maxBytes = maxBytes;
+		Direction dirs[NumDirections];
+		const int nLegal = board.GetLegalMoves(dirs);
+		timeManager.StartMove(board.NumAvailableTiles(), BoardType::NumCells, nLegal);
+		if (timeManager.IsForced()) {
+			nodes = 0;
+			bBudgetHit = false;
+			ms = 0.0;
+			return nLegal == 1 ? dirs[0] : None;
+		}
+
+		Direction best = dirs[0];
+		for(int depth=1; depth<=maxMoveDepth; ++depth){
+			bool bStopped = false;
+			float score[NumDirections];
+			for(int i=0; i<nLegal && !bStopped; ++i){
+				BoardType b = board;
+				b.Slide(dirs[i]);
+				search.Start(b, depth - 1);
+				while(search.Step()){
+					// Depth 1 always finishes, so there is a move to play.
+					if ((search.nodes & 1023) == 0 && depth > 1 && timeManager.OutOfTime(ElapsedMS())) {
+						bStopped = true;
+						break;
+					}
+				}
+				score[i] = search.Value();
+			}
+			if (bStopped) break;
+
+			int iBest = 0;
+			for(int i=1; i<nLegal; ++i)
+				if (score[i] > score[iBest]) iBest = i;
+			float scoreGap = std::numeric_limits<float>::infinity();
+			for(int i=0; i<nLegal; ++i)
+				if (i != iBest) scoreGap = std::min(scoreGap, score[iBest] - score[i]);
+			best = dirs[iBest];
+			moveDepth = depth;
+			if (!KeepSearching(ElapsedMS(), scoreGap)) break;
+		}
+
+		nodes = search.nodes;
+		bBudgetHit = search.bBudgetHit;
+		search.Clear();
+		ms = ElapsedMS();
+		timeManager.EndMove(ms);
+		return best;
+	}
+
+	static float Eval(const BoardType& board) { return ExpectimaxT<BoardType>::Eval(board); }
+
+	TimeManager timeManager;
+	int maxMoveDepth;
+	size_t maxBytes;
+	size_t nodes;    // nodes visited by the last search
+	int moveDepth;   // deepest depth the last search completed
+	double ms;       // time taken by the last search
+	bool bBudgetHit; // the caches of the last search filled the memory budget
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	// Wall time, as in SearchPlayer.
+	double ElapsedMS() const { return std::chrono::duration<double, std::milli>(Clock::now() - start).count(); }
+
+	// Same decision as SearchPlayer::KeepSearching; there are no death
+	// probabilities here, so only the score gap counts.
+	bool KeepSearching(double elapsedMS, float scoreGap) const
+	{
+		if (timeManager.OutOfTime(elapsedMS)) return false;
+		if (!timeManager.WantsGaps(elapsedMS)) return true;
+		return timeManager.ShouldContinue(elapsedMS, 0.0f, scoreGap);
+	}
+
+	ExpectimaxT<BoardType> search;
+	Clock::time_point start;
+};
+
+#endif
@@ -0,0 +1,214 @@
+#include "search_tree.h"
+
+// Faults in the capacity of v past its size across the pool.
+template<class V>
+static void TouchTail(ThreadPool* pool, V& v)
+{
+	FirstTouch(pool, v.data() + v.size(), v.data() + v.capacity());
+}
+
+// Adds the resident pages of v on each NUMA node to counts.
+template<class V>
+static bool AddPages(const V& v, std::vector<size_t>* counts)
+{
+	std::vector<size_t> c;
+	if (!PagesByNode(v.data(), v.capacity() * sizeof(v[0]), &c, 256)) return false;
+	if (c.size() > counts->size()) counts->resize(c.size(), 0);
+	for(size_t i=0; i<c.size(); ++i) (*counts)[i] += c[i];
+	return true;
+}
+
+uint32_t MovePly::Add(uint64_t b, int gs)
+{
+	const uint32_t ix = (uint32_t)board.size();
+	board.push_back(b);
+	gameScore.push_back(gs);
+	score.push_back(ScoreValue());
+	probDeath.push_back(DeathValue());
+	firstKid.push_back(0);
+	numKids.push_back(0);
+	return ix;
+}
+
+void MovePly::Clear()
+{
+	board.clear();
+	gameScore.clear();
+	score.clear();
+	probDeath.clear();
+	firstKid.clear();
+	numKids.clear();
+}
+
+void MovePly::Reserve(size_t n)
+{
+	board.reserve(n);
+	gameScore.reserve(n);
+	score.reserve(n);
+	probDeath.reserve(n);
+	firstKid.reserve(n);
+	numKids.reserve(n);
+}
+
+void MovePly::Resize(size_t n)
+{
+	board.resize(n);
+	gameScore.resize(n);
+	score.resize(n);
+	probDeath.resize(n);
+	firstKid.resize(n);
+	numKids.resize(n);
+}
+
+void MovePly::FirstTouch(ThreadPool* pool)
+{
+	TouchTail(pool, board);
+	TouchTail(pool, gameScore);
+	TouchTail(pool, score);
+	TouchTail(pool, probDeath);
+	TouchTail(pool, firstKid);
+	TouchTail(pool, numKids);
+}
+
+Board MovePly::GetBoard(uint32_t i) const
+{
+	Board b;
+	b.SetBits(board[i]);
+	b.score = gameScore[i];
+	return b;
+}
+
+uint32_t TilePly::Add(uint64_t b, int gs, byte w)
+{
+	const uint32_t ix = (uint32_t)board.size();
+	board.push_back(b);
+	gameScore.push_back(gs);
+	score.push_back(ScoreValue());
+	probDeath.push_back(DeathValue());
+	for(int i=0; i<NumDirections; ++i)
+		kids.push_back(NoKid);
+	weight.push_back(w);
+	return ix;
+}
+
+void TilePly::Clear()
+{
+	board.clear();
+	gameScore.clear();
+	score.clear();
+	probDeath.clear();
+	kids.clear();
+	weight.clear();
+}
+
+void TilePly::Reserve(size_t n)
+{
+	board.reserve(n);
+	gameScore.reserve(n);
+	score.reserve(n);
+	probDeath.reserve(n);
+	kids.reserve(n * NumDirections);
+	weight.reserve(n);
+}
+
+void TilePly::Resize(size_t n)
+{
+	board.resize(n);
+	gameScore.resize(n);
+	score.resize(n);
+	probDeath.resize(n);
+	kids.resize(n * NumDirections, NoKid);
+	weight.resize(n);
+}
+
+void TilePly::FirstTouch(ThreadPool* pool)
+{
+	TouchTail(pool, board);
+	TouchTail(pool, gameScore);
+	TouchTail(pool, score);
+	TouchTail(pool, probDeath);
+	TouchTail(pool, kids);
+	TouchTail(pool, weight);
+}
+
+Board TilePly::GetBoard(uint32_t i) const
+{
+	Board b;
+	b.SetBits(board[i]);
+	b.score = gameScore[i];
+	return b;
+}
+
+bool TilePly::HasKids(uint32_t i) const
+{
+	const uint32_t* k = &kids[NumDirections * i];
+	return (k[0] & k[1] & k[2] & k[3]) != NoKid;
+}
+
+SearchTree::SearchTree() : nTilePlies(0), nMovePlies(0) {}
+
+void SearchTree::Clear()
+{
+	while(nTilePlies > 0) PopTilePly();
+	while(nMovePlies > 0) PopMovePly();
+}
+
+TilePly& SearchTree::AddTilePly()
+{
+	if (nTilePlies == (int)tilePlies.size()) tilePlies.push_back(TilePly());
+	TilePly& ply = tilePlies[nTilePlies++];
+	ply.Clear();
+	return ply;
+}
+
+MovePly& SearchTree::AddMovePly()
+{
+	if (nMovePlies == (int)movePlies.size()) movePlies.push_back(MovePly());
+	MovePly& ply = movePlies[nMovePlies++];
+	ply.Clear();
+	return ply;
+}
+
+void SearchTree::PopTilePly()
+{
+	tilePlies[--nTilePlies].Clear();
+}
+
+void SearchTree::PopMovePly()
+{
+	movePlies[--nMovePlies].Clear();
+}
+
+size_t SearchTree::NumNodes() const
+{
+	size_t n = 0;
+	for(int k=0; k<nTilePlies; ++k) n += tilePlies[k].Size();
+	for(int k=0; k<nMovePlies; ++k) n += movePlies[k].Size();
+	return n;
+}
+
+// Memory held by all plies, including buffers kept from earlier searches.
+size_t SearchTree::NumBytes() const
+{
+	size_t n = 0;
+	for(size_t k=0; k<tilePlies.size(); ++k) n += tilePlies[k].Bytes();
+	for(size_t k=0; k<movePlies.size(); ++k) n += movePlies[k].Bytes();
+	return n;
+}
+
+bool SearchTree::PagesByNode(std::vector<size_t>* counts) const
+{
+	counts->clear();
+	bool bOK = true;
+	for(size_t k=0; k<tilePlies.size(); ++k){
+		const TilePly& t = tilePlies[k];
+		bOK = bOK && AddPages(t.board, counts) && AddPages(t.gameScore, counts) && AddPages(t.score, counts)
+			&& AddPages(t.probDeath, counts) && AddPages(t.kids, counts) && AddPages(t.weight, counts);
+	}
+	for(size_t k=0; k<movePlies.size(); ++k){
+		const MovePly& m = movePlies[k];
+		bOK = bOK && AddPages(m.board, counts) && AddPages(m.gameScore, counts) && AddPages(m.score, counts)
+			&& AddPages(m.probDeath, counts) && AddPages(m.firstKid, counts) && AddPages(m.numKids, counts);
+	}
+	return bOK;
+}
@@ -0,0 +1,152 @@
+#ifndef __SEARCH_TREE_H__
+#define __SEARCH_TREE_H__
+
+#include <stdint.h>
+#include <xmmintrin.h>
+#include <algorithm>
+#include <vector>
+#include "board.h"
+#include "large_pages.h"
+
+static const uint32_t NoKid = 0xFFFFFFFF;
+
+// Compact node values: a score in 16-bit fixed point with ScoreScale steps
+// per unit, saturating at the ends of the range (so -infinity becomes the
+// lowest score), and a death probability as a fraction of 65535.
+typedef int16_t CompactScore;
+typedef uint16_t CompactDeath;
+static const float ScoreScale = 512.0f;
+
+inline CompactScore PackScore(float s)
+{
+	return (CompactScore)_mm_cvt_ss2si(_mm_set_ss(std::min(std::max(s * ScoreScale, -32768.0f), 32767.0f)));
+}
+inline float UnpackScore(CompactScore s)
+{
+	return s * (1.0f / ScoreScale);
+}
+inline CompactDeath PackDeath(float d)
+{
+	return (CompactDeath)_mm_cvt_ss2si(_mm_set_ss(std::min(std::max(d, 0.0f), 1.0f) * 65535.0f));
+}
+inline float UnpackDeath(CompactDeath d)
+{
+	return d * (1.0f / 65535.0f);
+}
+
+// Node values as stored in the plies: floats, or compact ones when built
+// with COMPACT_VALUES, which takes 4 bytes off every node for a small
+// quantization error (see TimeCompactBackup).  The tree reads and writes
+// them only through these.
+#ifdef COMPACT_VALUES
+typedef CompactScore ScoreValue;
+typedef CompactDeath DeathValue;
+inline ScoreValue ToScore(float s) { return PackScore(s); }
+inline float FromScore(ScoreValue s) { return UnpackScore(s); }
+inline DeathValue ToDeath(float d) { return PackDeath(d); }
+inline float FromDeath(DeathValue d) { return UnpackDeath(d); }
+#else
+typedef float ScoreValue;
+typedef float DeathValue;
+inline ScoreValue ToScore(float s) { return s; }
+inline float FromScore(ScoreValue s) { return s; }
+inline DeathValue ToDeath(float d) { return d; }
+inline float FromDeath(DeathValue d) { return d; }
+#endif
+
+// Board states that result from a move, stored as structure-of-arrays.
+// The next step is to add a random tile: the kids of node i are the nodes
+// [firstKid[i], firstKid[i] + numKids[i]) of the next tile ply, a 2 and a 4
+// for each open cell in cell order.  Of cells that the board's own
+// symmetries map onto each other only the first gets kids, weighted by the
+// number of cells.
+class MovePly
+{
+public:
+	uint32_t Add(uint64_t b, int gameScore);
+	void Clear();
+	void Reserve(size_t n);
+	void Resize(size_t n); // new nodes are zero, to be filled in place
+	void FirstTouch(ThreadPool* pool); // the capacity past Size()
+
+	size_t Size() const { return board.size(); }
+	size_t Capacity() const { return board.capacity(); }
+	size_t Bytes() const { return Capacity() * NodeBytes; }
+	Board GetBoard(uint32_t i) const;
+
+	PageVector<uint64_t> board;
+	PageVector<int> gameScore;
+	PageVector<ScoreValue> score;
+	PageVector<DeathValue> probDeath;
+	PageVector<uint32_t> firstKid;
+	PageVector<byte> numKids;
+
+	static const size_t NodeBytes = sizeof(uint64_t) + sizeof(int) + sizeof(ScoreValue)
+		+ sizeof(DeathValue) + sizeof(uint32_t) + sizeof(byte);
+};
+
+// Board states that result from adding a random tile, stored as
+// structure-of-arrays.  The next step is a move: kids[4*i + dir] is the index
+// of the node in the next move ply, or NoKid.
+class TilePly
+{
+public:
+	uint32_t Add(uint64_t b, int gameScore, byte weight = 1);
+	void Clear();
+	void Reserve(size_t n);
+	void Resize(size_t n); // new nodes are zero with no kids, to be filled in place
+	void FirstTouch(ThreadPool* pool); // the capacity past Size()
+
+	size_t Size() const { return board.size(); }
+	size_t Capacity() const { return board.capacity(); }
+	size_t Bytes() const { return Capacity() * NodeBytes; }
+	Board GetBoard(uint32_t i) const;
+	bool HasKids(uint32_t i) const;
+
+	PageVector<uint64_t> board;
+	PageVector<int> gameScore;
+	PageVector<ScoreValue> score;
+	PageVector<DeathValue> probDeath;
+	PageVector<uint32_t> kids;
+	PageVector<byte> weight; // number of equivalent spawns
+
+	static const size_t NodeBytes = sizeof(uint64_t) + sizeof(int) + sizeof(ScoreValue)
+		+ sizeof(DeathValue) + NumDirections*sizeof(uint32_t) + sizeof(byte);
+};
+
+// Search tree stored ply by ply.  Node arrays come from AllocPages, so big
+// plies can sit on huge pages.  Tile ply 0 holds just the root; move ply k
+// holds the kids of tile ply k, and tile ply k+1 the kids of move ply k.
+// Plies keep their buffers between searches so a player reaches a steady
+// state with no allocation.
+class SearchTree
+{
+public:
+	SearchTree();
+
+	void Clear();
+	TilePly& AddTilePly();
+	MovePly& AddMovePly();
+	void PopTilePly();
+	void PopMovePly();
+
+	TilePly& Tiles(int k) { return tilePlies[k]; }
+	MovePly& Moves(int k) { return movePlies[k]; }
+	const TilePly& Tiles(int k) const { return tilePlies[k]; }
+	const MovePly& Moves(int k) const { return movePlies[k]; }
+	int NumTilePlies() const { return nTilePlies; }
+	int NumMovePlies() const { return nMovePlies; }
+
+	size_t NumNodes() const;
+	size_t NumBytes() const;
+	// Resident pages of the node arrays on each NUMA node, as PagesByNode.
+	bool PagesByNode(std::vector<size_t>* counts) const;
+
+private:
+	std::vector<TilePly> tilePlies;
+	std::vector<MovePly> movePlies;
+	int nTilePlies;
+	int nMovePlies;
+};
+
+#endif
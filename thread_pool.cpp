@@ -0,0 +1,76 @@
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(int numThreads)
+  : job(nullptr), jobSize(0), jobGrain(1), nextItem(0), generation(0), nPending(0),
+    bQuit(false)
+{
+  if (numThreads <= 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+  for(int i=1; i<numThreads; ++i)
+    workers.push_back(std::thread(&ThreadPool::WorkerLoop, this, i));
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    bQuit = true;
+  }
+  wake.notify_all();
+  for(size_t i=0; i<workers.size(); ++i)
+    workers[i].join();
+}
+
+void ThreadPool::RunChunks(int iThread)
+{
+  while(true){
+    size_t begin = nextItem.fetch_add(jobGrain);
+    if (begin >= jobSize) break;
+    (*job)(begin, std::min(begin + jobGrain, jobSize), iThread);
+  }
+}
+
+void ThreadPool::WorkerLoop(int iThread)
+{
+  int seen = 0;
+  while(true){
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [&]{ return bQuit || generation != seen; });
+      if (bQuit) return;
+      seen = generation;
+    }
+    RunChunks(iThread);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--nPending == 0) done.notify_one();
+    }
+  }
+}
+
+void ThreadPool::ParallelFor(size_t n, size_t grain, const RangeFunc& fn)
+{
+  if (grain < 1) grain = 1;
+  if (workers.empty() || n <= grain) {
+    for(size_t begin=0; begin<n; begin+=grain)
+      fn(begin, std::min(begin + grain, n), 0);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    job = &fn;
+    jobSize = n;
+    jobGrain = grain;
+    nextItem.store(0);
+    nPending = (int)workers.size();
+    ++generation;
+  }
+  wake.notify_all();
+  RunChunks(0);
+
+  // Every worker checks in once per loop, even if the chunks were all
+  // claimed before it woke, so the job can't change under a late worker.
+  std::unique_lock<std::mutex> lock(mutex);
+  done.wait(lock, [&]{ return nPending == 0; });
+  job = nullptr;
+}
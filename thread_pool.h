@@ -0,0 +1,45 @@
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for data-parallel loops.
+// The calling thread takes part in every loop as thread 0, so a pool of one
+// thread has no workers and runs everything inline.
+class ThreadPool
+{
+public:
+  typedef std::function<void(size_t begin, size_t end, int iThread)> RangeFunc;
+
+  ThreadPool(int numThreads = 0); // 0 = hardware concurrency
+  ~ThreadPool();
+
+  int NumThreads() const { return (int)workers.size() + 1; }
+
+  // Calls fn on chunks of at most grain items covering [0, n) and returns
+  // when all are done.  Chunks are handed out dynamically.
+  void ParallelFor(size_t n, size_t grain, const RangeFunc& fn);
+
+private:
+  void WorkerLoop(int iThread);
+  void RunChunks(int iThread);
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  const RangeFunc* job;
+  size_t jobSize;
+  size_t jobGrain;
+  std::atomic<size_t> nextItem;
+  int generation;
+  int nPending;
+  bool bQuit;
+};
+
+#endif
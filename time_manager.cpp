@@ -0,0 +1,58 @@
+#include <algorithm>
+#include "time_manager.h"
+
+TimeManager::TimeManager()
+	: baseMS(30.0), maxExtension(3.0), gameBudgetMS(0.0), reserveMoves(200.0),
+	  closeDeathGap(0.01f), closeScoreGap(0.05f), dominanceFraction(0.25),
+	  dominantDeathGap(0.05f), dominantScoreGap(1.0f), softMS(0.0), hardMS(0.0),
+	  usedMS(0.0), bForced(false)
+{
+}
+
+void TimeManager::NewGame()
+{
+	usedMS = 0.0;
+}
+
+void TimeManager::StartMove(const Board& board, int nLegal)
+{
+	StartMove(board.NumAvailableTiles(), 16, nLegal);
+}
+
+void TimeManager::StartMove(int nEmpty, int nCells, int nLegal)
+{
+	bForced = (nLegal <= 1);
+	if (bForced) {
+		softMS = hardMS = 0.0;
+		return;
+	}
+
+	// Crowded boards are where games are lost: up to 2x the base budget on a
+	// full board, down to half on an empty one.  More legal moves means more
+	// alternatives to tell apart.
+	const int maxEmpty = std::max(nCells - 1, 1);
+	double factor = 0.5 + 1.5 * (1.0 - std::min(nEmpty, maxEmpty) / (double)maxEmpty);
+	factor *= 0.75 + 0.125 * nLegal;
+
+	softMS = baseMS * factor;
+	hardMS = softMS * maxExtension;
+	if (gameBudgetMS > 0.0) {
+		// No floor: a spent game budget leaves nothing past the first ply.
+		const double cap = std::max(0.0, gameBudgetMS - usedMS) / reserveMoves;
+		hardMS = std::min(hardMS, cap);
+		softMS = std::min(softMS, hardMS);
+	}
+}
+
+void TimeManager::EndMove(double elapsedMS)
+{
+	usedMS += elapsedMS;
+}
+
+bool TimeManager::ShouldContinue(double elapsedMS, float deathGap, float scoreGap) const
+{
+	if (elapsedMS >= hardMS) return false;
+	if (deathGap >= dominantDeathGap || scoreGap >= dominantScoreGap) return false;
+	if (elapsedMS < softMS) return true;
+	return deathGap < closeDeathGap && scoreGap < closeScoreGap;
+}
@@ -0,0 +1,54 @@
+#ifndef __TIME_MANAGER_H__
+#define __TIME_MANAGER_H__
+
+#include "board.h"
+
+// Decides how long the search may spend on a move.
+// The soft budget scales with how crowded the board is and how many moves
+// are legal.  From dominanceFraction of it on, the search stops as soon as
+// the best root move clearly dominates the rest.  Once it is used up, the
+// search keeps going (up to the hard budget) only while the best two root
+// moves are too close to call.  A per-game budget is shared out over the
+// remaining moves; once it is spent, moves get no time beyond the first ply.
+class TimeManager
+{
+public:
+	TimeManager();
+
+	void NewGame();
+	void StartMove(const Board& board, int nLegal);
+	void StartMove(int nEmpty, int nCells, int nLegal); // for boards of any size
+	void EndMove(double elapsedMS);
+
+	// Only one legal move; no search needed.
+	bool IsForced() const { return bForced; }
+
+	// True once the search should back up its tree after each depth and
+	// ask ShouldContinue.
+	bool WantsGaps(double elapsedMS) const { return elapsedMS >= dominanceFraction * softMS; }
+
+	// Called after each completed depth with the gaps between the best and
+	// second-best root moves.  Returns true if the search should go deeper.
+	bool ShouldContinue(double elapsedMS, float deathGap, float scoreGap) const;
+
+	bool OutOfTime(double elapsedMS) const { return elapsedMS >= hardMS; }
+
+	double baseMS;         // soft budget for an ordinary position
+	double maxExtension;   // hard budget as a multiple of the soft budget
+	double gameBudgetMS;   // total for one game, <= 0 for no limit
+	double reserveMoves;   // remaining game budget is spread over this many moves
+	float closeDeathGap;   // root moves closer than this are "close"
+	float closeScoreGap;
+	double dominanceFraction; // of the soft budget, before a dominant move can stop the search
+	float dominantDeathGap;   // root moves further apart than this are decided
+	float dominantScoreGap;
+
+	double softMS;
+	double hardMS;
+	double usedMS;         // spent so far in this game
+
+private:
+	bool bForced;
+};
+
+#endif
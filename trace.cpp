@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "trace.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+const Clock::time_point origin = Clock::now();
+
+struct TraceEvent
+{
+	const char* name;
+	char phase;    // 'X' = span, 'C' = counter
+	double ts;     // microseconds since startup
+	double dur;
+	long long value;
+};
+
+struct ThreadTrace
+{
+	int tid;
+	std::vector<TraceEvent> events;
+	std::vector<long long> counts; // by counter id
+};
+
+// Every thread's buffer, plus the names of the tally counters; sites that
+// use the same name share a tally.  Buffers
+// live until exit so events from finished threads can still be written.
+struct TraceRegistry
+{
+	std::mutex mutex;
+	std::vector<std::unique_ptr<ThreadTrace> > threads;
+	std::vector<const char*> counterNames;
+};
+
+TraceRegistry& Registry()
+{
+	static TraceRegistry registry;
+	return registry;
+}
+
+ThreadTrace& Local()
+{
+	static thread_local ThreadTrace* local = nullptr;
+	if (local == nullptr) {
+		TraceRegistry& reg = Registry();
+		std::lock_guard<std::mutex> lock(reg.mutex);
+		reg.threads.push_back(std::unique_ptr<ThreadTrace>(new ThreadTrace()));
+		local = reg.threads.back().get();
+		local->tid = (int)reg.threads.size() - 1;
+		local->events.reserve(1 << 16);
+	}
+	return *local;
+}
+
+}
+
+double Trace::NowUS()
+{
+	return std::chrono::duration<double, std::micro>(Clock::now() - origin).count();
+}
+
+void Trace::Span(const char* name, double startUS, double endUS)
+{
+	TraceEvent e = { name, 'X', startUS, endUS - startUS, 0 };
+	Local().events.push_back(e);
+}
+
+void Trace::Counter(const char* name, long long value)
+{
+	TraceEvent e = { name, 'C', NowUS(), 0.0, value };
+	Local().events.push_back(e);
+}
+
+int Trace::CounterId(const char* name)
+{
+	TraceRegistry& reg = Registry();
+	std::lock_guard<std::mutex> lock(reg.mutex);
+	for(size_t id=0; id<reg.counterNames.size(); ++id)
+		if (strcmp(reg.counterNames[id], name) == 0) return (int)id;
+	reg.counterNames.push_back(name);
+	return (int)reg.counterNames.size() - 1;
+}
+
+void Trace::Count(int id, long long n)
+{
+	ThreadTrace& t = Local();
+	if (id >= (int)t.counts.size()) t.counts.resize(id + 1, 0);
+	t.counts[id] += n;
+}
+
+void Trace::FlushCounts()
+{
+	TraceRegistry& reg = Registry();
+	std::vector<long long> sums;
+	{
+		std::lock_guard<std::mutex> lock(reg.mutex);
+		sums.assign(reg.counterNames.size(), 0);
+		for(size_t i=0; i<reg.threads.size(); ++i){
+			std::vector<long long>& counts = reg.threads[i]->counts;
+			for(size_t id=0; id<counts.size(); ++id){
+				sums[id] += counts[id];
+				counts[id] = 0;
+			}
+		}
+	}
+	for(size_t id=0; id<sums.size(); ++id)
+		Counter(reg.counterNames[id], sums[id]);
+}
+
+bool Trace::Write(const char* path)
+{
+	FILE* f = fopen(path, "w");
+	if (f == NULL) return false;
+
+	TraceRegistry& reg = Registry();
+	std::lock_guard<std::mutex> lock(reg.mutex);
+	fprintf(f, "{\"traceEvents\":[\n");
+	bool bFirst = true;
+	for(size_t i=0; i<reg.threads.size(); ++i){
+		const ThreadTrace& t = *reg.threads[i];
+		for(size_t j=0; j<t.events.size(); ++j){
+			const TraceEvent& e = t.events[j];
+			fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%.3f",
+				bFirst ? "" : ",\n", e.name, e.phase, t.tid, e.ts);
+			if (e.phase == 'X') fprintf(f, ",\"dur\":%.3f}", e.dur);
+			else fprintf(f, ",\"args\":{\"value\":%lld}}", e.value);
+			bFirst = false;
+		}
+	}
+	fprintf(f, "\n]}\n");
+	fclose(f);
+	return true;
+}
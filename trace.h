@@ -0,0 +1,63 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+
+// Hot-path tracing, compiled in only when TRACING is defined; otherwise
+// every TRACE_ macro expands to nothing.
+//
+//   TRACE_SCOPE(name)        timed span from here to the end of the scope
+//   TRACE_COUNTER(name, v)   records the current value of a counter
+//   TRACE_COUNT(name, n)     adds n to a per-thread tally; cheap enough for
+//                            per-call use in hot functions
+//   TRACE_FLUSH_COUNTS()     emits the tallies, summed over threads, as
+//                            counter values and zeroes them
+//   TRACE_WRITE(path)        writes everything recorded so far as Chrome
+//                            trace-event JSON (chrome://tracing, Perfetto)
+//
+// Events go to a buffer owned by the recording thread, so recording takes
+// no locks.  Names must be string literals.  Flush and write read every
+// thread's buffer and must only be called while the other threads are idle.
+class Trace
+{
+public:
+	static double NowUS();
+	static void Span(const char* name, double startUS, double endUS);
+	static void Counter(const char* name, long long value);
+	static int CounterId(const char* name);
+	static void Count(int id, long long n);
+	static void FlushCounts();
+	static bool Write(const char* path);
+};
+
+class TraceScope
+{
+public:
+	TraceScope(const char* name_) : name(name_), startUS(Trace::NowUS()) {}
+	~TraceScope() { Trace::Span(name, startUS, Trace::NowUS()); }
+
+private:
+	const char* name;
+	double startUS;
+};
+
+#ifdef TRACING
+#define TRACE_CAT2(a, b) a##b
+#define TRACE_CAT(a, b) TRACE_CAT2(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CAT(traceScope, __LINE__)(name)
+#define TRACE_COUNTER(name, v) Trace::Counter(name, (long long)(v))
+#define TRACE_COUNT(name, n) do { \
+		static const int traceId = Trace::CounterId(name); \
+		Trace::Count(traceId, (long long)(n)); \
+	} while(0)
+#define TRACE_FLUSH_COUNTS() Trace::FlushCounts()
+#define TRACE_WRITE(path) Trace::Write(path)
+#else
+#define TRACE_SCOPE(name)
+#define TRACE_COUNTER(name, v)
+#define TRACE_COUNT(name, n)
+#define TRACE_FLUSH_COUNTS()
+#define TRACE_WRITE(path)
+#endif
+
+#endif
@@ -1,8 +1,30 @@
 #include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <limits>
 #include <unordered_set>
+#include <vector>
 
 #include "unit_tests.h"
+#include "batch_eval.h"
+#include "batch_runner.h"
 #include "board.h"
+#include "board_t.h"
+#include "coro_search.h"
+#include "eval_cache.h"
+#include "game_analysis.h"
+#include "large_pages.h"
+#include "mcts_player.h"
+#include "opening_book.h"
+#include "playout_engine.h"
+#include "position_suite.h"
+#include "random_player.h"
+#include "search_player.h"
+#include "search_player_t.h"
+#include "thread_pool.h"
+#include "time_manager.h"
 
 void RunUnitTests()
 {  
@@ -55,6 +77,11 @@ void RunUnitTests()
   assert(b1.GetReverseCol(1) == 0x159d);
   assert(b1.GetReverseCol(2) == 0x26ae);
   assert(b1.GetReverseCol(3) == 0x37bf);
+  assert(b1.Bits() == v);
+  b2.SetBits(Board::Transpose(v));
+  for(int i=0; i<4; ++i)
+    assert(b2.board[i] == b1.GetCol(i));
+  assert(Board::Transpose(b2.Bits()) == v);
   assert(b1.NumAvailableTiles() == 1);
   assert(b1.CanSlideUp());
   assert(!b1.CanSlideRight());
@@ -127,6 +154,40 @@ void RunUnitTests()
   b2.Reset();
   b2.SetCol(0,4,3,2,1);
   assert(b1.GetCanonical() == b2.GetCanonical());
+  // Orientations that tie on CanonicalScore still agree
+  b1.Reset();
+  b1.SetRow(0,1,0,0,2);
+  b1.SetRow(3,2,0,0,1);
+  b2 = b1;
+  for(int i=0; i<8; ++i){
+    if (i == 4) b2.ReflectVert();
+    b2.RotateCW();
+    assert(b2.GetCanonical() == b1.GetCanonical());
+  }
+
+  // Test symmetries: transforms move cells where TransformCell says, and
+  // spawn cells cover each open cell's orbit once
+  for(int sym=0; sym<8; ++sym)
+    for(int ix=0; ix<16; ++ix)
+      assert(Board::Transform(5ULL << (4*ix), sym) == 5ULL << (4*Board::TransformCell(ix, sym)));
+  b1.Reset();
+  assert(Board::Symmetries(b1.Bits()) == 0xFF);
+  byte cells[16], weights[16];
+  assert(b1.GetSpawnCells(cells, weights) == 3); // corners, edges, middle
+  assert(weights[0] == 4 && weights[1] == 8 && weights[2] == 4);
+  b1.SetRow(0,1,0,0,1);
+  b1.SetRow(3,1,0,0,1);
+  assert(b1.GetSpawnCells(cells, weights) == 2); // edges, middle
+  b1.SetRow(0,1,2,0,0);
+  assert(Board::Symmetries(b1.Bits()) == 1);
+  assert(b1.GetSpawnCells(cells, weights) == 12);
+  b1.Reset();
+  b1.SetRow(0,3,1,0,0);
+  b1.SetRow(1,1,0,0,0);
+  assert(Board::Symmetries(b1.Bits()) == (1 | 1 << 4)); // the diagonal
+  int nSpawns = b1.GetSpawnCells(cells, weights), sumWeights = 0;
+  for(int i=0; i<nSpawns; ++i) sumWeights += weights[i];
+  assert(nSpawns == 8 && sumWeights == 13);
 
   // Test SmoothnessScore
   b1.Reset();
@@ -237,4 +298,539 @@ void RunUnitTests()
   b1.SetRow(0, 1, 2, 3, 4);
   assert(!b1.CanSlideLeft());
   assert(!b1.SlideLeft());
-}
\ No newline at end of file
+
+  // Test the merged slide table against SlideLeftSlow
+  for(int r=0; r<65536; ++r){
+    ushort row = (ushort)r;
+    int score = 0;
+    Board::SlideLeftSlow(&row, &score);
+    assert(Board::SlideRowLeft((ushort)r) == row);
+    assert(Board::SlideRowLeftScore((ushort)r) == score);
+  }
+
+  // Test BatchEval against the scalar Eval on boards from random games
+  RNG rng(99);
+  std::vector<uint64_t> boards;
+  std::vector<int> scores;
+  b1.Reset();
+  while(boards.size() < 1000){
+    Direction dirs[4];
+    int n = b1.GetLegalMoves(dirs);
+    if (n == 0) {
+      b1.Reset();
+      b1.AddRandomTile(rng);
+      continue;
+    }
+    b1.Slide(dirs[rng.NextInt() % n]);
+    b1.AddRandomTile(rng);
+    boards.push_back(b1.Bits());
+    scores.push_back(b1.score);
+  }
+  std::vector<float> evals(boards.size());
+  std::vector<byte> dead(boards.size());
+  BatchEval::Eval(&boards[0], &scores[0], boards.size(), &evals[0], &dead[0]);
+  // The scalar side is built cell by cell, so it doesn't share Bits and
+  // SetBits with BatchEval.
+  for(size_t i=0; i<boards.size(); ++i){
+    b1.SetBits(boards[i]);
+    b1.score = scores[i];
+    b2.Reset();
+    for(int ix=0; ix<16; ++ix) b2.SetCell(ix, (ushort)((boards[i] >> (4*ix)) & 0xF));
+    b2.score = scores[i];
+    assert(b2 == b1 && b2.Bits() == boards[i]);
+#ifndef NDEBUG
+    float e = SearchPlayer::Eval(b2);
+#endif
+    assert(e == evals[i] || fabs(e - evals[i]) <= 1e-4f * std::max(1.0f, fabs(e)));
+    assert((dead[i] != 0) == b1.IsDead());
+  }
+
+  // Test EvalCache against BatchEval, cold and then warm on the last few
+  // boards, with a cache small enough to have collisions
+  EvalCache cache;
+  cache.Resize(100);
+  assert(cache.Size() == 64);
+  for(int pass=0; pass<2; ++pass){
+    const size_t first = (pass == 0 ? 0 : boards.size() - 32);
+    const size_t n = boards.size() - first;
+    std::vector<float> cached(n);
+    std::vector<byte> cachedDead(n);
+    cache.Eval(&boards[first], &scores[first], n, &cached[0], &cachedDead[0]);
+#ifndef NDEBUG
+    for(size_t i=0; i<n; ++i){
+      const float e = evals[first + i];
+      assert(cached[i] == e || fabs(cached[i] - e) <= 1e-4f * std::max(1.0f, fabs(e)));
+      assert(cachedDead[i] == dead[first + i]);
+    }
+#endif
+  }
+  assert(cache.hits > 0 && cache.hits + cache.misses == boards.size() + 32);
+
+  // Test GenerateMoves against Slide/CanSlide
+  for(size_t i=0; i<boards.size(); ++i){
+    b1.SetBits(boards[i]);
+    b1.score = scores[i];
+#ifndef NDEBUG
+    Board succ[4];
+    int mask = b1.GenerateMoves(succ);
+#endif
+    assert(mask == b1.LegalMoveMask());
+    for(int dir=0; dir<NumDirections; ++dir){
+      b2 = b1;
+      assert(b2.Slide((Direction)dir) == ((mask & (1 << dir)) != 0));
+      assert(b2 == succ[dir] && b2.score == succ[dir].score);
+      assert(b1.CanSlide((Direction)dir) == ((mask & (1 << dir)) != 0));
+    }
+  }
+
+  // Test PlayoutEngine against scalar games that take the same draws: the
+  // engine moves every live game, then spawns in each, retiring dead games
+  // by swapping in the last live one
+  {
+    const int nGames = 5;
+    uint64_t starts[nGames];
+    int startScores[nGames], finalScores[nGames], depths[nGames];
+    RNG startRng(11);
+    for(int i=0; i<nGames; ++i){
+      b1.Reset();
+      for(int j=0; j<=2*i; ++j) b1.AddRandomTile(startRng);
+      starts[i] = b1.Bits();
+      startScores[i] = 4 * i;
+    }
+    PlayoutEngine engine(nGames);
+    for(unsigned int seed=1; seed<=3; ++seed){
+      engine.Run(starts, startScores, nGames, seed, finalScores, depths);
+
+      RNG rng(seed);
+      Board live[nGames];
+      int ids[nGames], nMoves[nGames];
+      Direction chosen[nGames];
+      for(int i=0; i<nGames; ++i){
+        live[i].SetBits(starts[i]);
+        live[i].score = startScores[i];
+        ids[i] = i;
+        nMoves[i] = 0;
+      }
+      int nLive = nGames;
+      while(nLive > 0){
+        for(int i=0; i<nLive; ++i){
+          Direction dirs[NumDirections];
+          const int nLegal = live[i].GetLegalMoves(dirs);
+          chosen[i] = nLegal > 0 ? dirs[rng.NextInt() % nLegal] : None;
+        }
+        for(int i=0; i<nLive; ){
+          if (chosen[i] != None) { ++i; continue; }
+          assert(finalScores[ids[i]] == live[i].score && depths[ids[i]] == nMoves[i]);
+          --nLive;
+          live[i] = live[nLive];
+          ids[i] = ids[nLive];
+          nMoves[i] = nMoves[nLive];
+          chosen[i] = chosen[nLive];
+        }
+        for(int i=0; i<nLive; ++i){
+          live[i].Slide(chosen[i]);
+          live[i].AddRandomTile(rng);
+          ++nMoves[i];
+        }
+      }
+    }
+  }
+
+  // Test BoardT<4,4,4> against Board
+  typedef BoardT<4, 4, 4> Board4x4;
+  Board4x4::Init();
+  for(size_t i=0; i<boards.size(); ++i){
+    b1.SetBits(boards[i]);
+    Board4x4 t;
+    for(int y=0; y<4; ++y) t.SetRow(y, b1.board[y]);
+    for(int dir=0; dir<NumDirections; ++dir){
+      b2 = b1;
+#ifndef NDEBUG
+      Board4x4 t2 = t;
+#endif
+      assert(b2.Slide((Direction)dir) == t2.Slide((Direction)dir));
+      assert(t2.score == b2.score - b1.score);
+      for(int y=0; y<4; ++y) assert(t2.GetRow(y) == b2.board[y]);
+    }
+    assert(t.IsDead() == b1.IsDead());
+    assert(t.SmoothnessScore() == b1.SmoothnessScore() && t.CornerScore() == b1.CornerScore());
+    t.score = b1.score = 1000 + (int)i;
+    assert(SearchPlayer::Eval(t) == SearchPlayer::Eval(b1));
+  }
+
+  // Test BoardT past 4-bit cells and off 4x4
+  BigTileBoard::Init();
+  BigTileBoard big;
+  big.SetCell(0, 0, 15);
+  big.SetCell(1, 0, 15);
+  assert(big.Slide(Left));
+  assert(big.GetCell(0, 0) == 16 && big.GetCell(1, 0) == 0 && big.score == 65536);
+  big.Reset();
+  big.SetCell(0, 0, 31);
+  big.SetCell(0, 1, 31);
+  assert(!big.CanSlide(Up) && !big.CanSlide(Left));
+  assert(big.Slide(Down));
+  assert(big.GetCell(0, 2) == 31 && big.GetCell(0, 3) == 31 && big.score == 0);
+
+  Board5x5::Init();
+  Board5x5 b5;
+  for(int y=0; y<5; ++y) b5.SetCell(4, y, 1);
+  assert(b5.Slide(Down));
+  assert(b5.GetCell(4, 4) == 2 && b5.GetCell(4, 3) == 2 && b5.GetCell(4, 2) == 1);
+  assert(b5.NumAvailableTiles() == 22 && b5.score == 8);
+
+  // Test that SearchPlayerT deepens within its time budget, and keeps to a
+  // depth cap and a memory budget
+  {
+    Board3x3::Init();
+    Board3x3 b3;
+    b3.SetCell(0, 0, 1);
+    b3.SetCell(1, 0, 1);
+    b3.SetCell(2, 1, 2);
+    SearchPlayerT<Board3x3> p3;
+    p3.timeManager.baseMS = 20.0;
+    Direction move = p3.FindBestMove(b3);
+    assert(move != None && b3.CanSlide(move) && p3.moveDepth >= 2);
+    assert(p3.ms < p3.timeManager.hardMS + 50.0);
+    p3.maxMoveDepth = 2;
+    p3.timeManager.baseMS = 1e9;
+    p3.SetMemoryBudget(0);
+    move = p3.FindBestMove(b3);
+    assert(move != None && p3.moveDepth == 2 && p3.bBudgetHit);
+    (void)move; // only asserted
+  }
+
+  // Test SeedRanges merging
+  SeedRanges seeds;
+  seeds.Add(5);
+  seeds.Add(7);
+  seeds.AddRange(10, 20);
+  assert(seeds.ranges.size() == 3 && seeds.Count() == 12);
+  seeds.Add(6);
+  assert(seeds.ranges.size() == 2 && seeds.ranges[0].first == 5 && seeds.ranges[0].second == 8);
+  seeds.AddRange(8, 12);
+  assert(seeds.ranges.size() == 1 && seeds.ranges[0].first == 5 && seeds.ranges[0].second == 20);
+  assert(seeds.Contains(5) && seeds.Contains(19) && !seeds.Contains(4) && !seeds.Contains(20));
+
+  // Test OpeningBook lookup from every orientation of the same position;
+  // the move found must lead to a board equivalent to the one stored
+  OpeningBook book;
+  b1.Reset();
+  b1.SetRow(0, 1, 2, 0, 0);
+  b1.SetRow(1, 0, 0, 1, 0);
+  book.Add(b1, Down);
+  book.Sort();
+  Board bookResult = b1;
+  bookResult.Slide(Down);
+  b2 = b1;
+  for(int i=0; i<8; ++i){
+    if (i == 4) b2.ReflectVert();
+    b2.RotateCW();
+    Direction bookMove = book.Lookup(b2);
+    assert(bookMove != None);
+    Board s2 = b2;
+    s2.Slide(bookMove);
+    assert(s2.GetCanonical() == bookResult.GetCanonical());
+  }
+  b1.SetRow(3, 1, 0, 0, 0);
+  assert(book.Lookup(b1) == None);
+
+  // Test that CoSearch gives the same answer however often it yields, that a
+  // forced move needs no search, and that the scheduler answers every board
+  b1.Reset();
+  b1.SetRow(0, 1, 2, 3, 0);
+  b1.SetRow(1, 0, 1, 0, 0);
+  const SearchClock::time_point never = SearchClock::time_point::max();
+  SearchTask whole = CoSearch(b1, 3, (size_t)-1, never);
+  SearchTask sliced = CoSearch(b1, 3, 7, never);
+  assert(!whole.Resume());
+  int nSlices = 0;
+  while(sliced.Resume()) ++nSlices;
+  assert(nSlices > 1);
+  assert(whole.Result().move == sliced.Result().move && whole.Result().move != None);
+  assert(whole.Result().depth == 3 && sliced.Result().nodes == whole.Result().nodes);
+  {
+    // The same search as SearchPlayerT<Board>, which finds the same move
+    SearchPlayerT<Board> t(3);
+    t.timeManager.baseMS = 1e9;
+    const Direction move = t.FindBestMove(b1);
+    assert(move == whole.Result().move && t.nodes == whole.Result().nodes);
+    (void)move; // only asserted
+  }
+  b2.Reset();
+  b2.SetRow(0, 1, 2, 1, 2);
+  b2.SetRow(1, 2, 1, 2, 1);
+  b2.SetRow(2, 1, 2, 1, 2);
+  SearchTask forced = CoSearch(b2, 3, 1, never);
+  assert(!forced.Resume() && forced.Result().nodes == 0 && forced.Result().move != None);
+  {
+    SearchScheduler scheduler(2);
+    scheduler.maxDepth = 2;
+    std::atomic<int> nAnswered(0);
+    for(int i=0; i<8; ++i)
+      scheduler.Submit(i & 1 ? b1 : b2, i % 3, 1000.0, [&](Direction move) {
+        if (move != None) ++nAnswered;
+      });
+    scheduler.WaitIdle();
+    assert(nAnswered == 8);
+  }
+
+  // Test that parallel ply expansion builds the same tree as the serial one
+  {
+    ThreadPool pool(3);
+    SearchPlayer serial(&pool), parallel(&pool);
+    serial.parallelExpandMin = (size_t)-1;
+    parallel.parallelExpandMin = 0;
+    SearchPlayer* players[2] = { &serial, &parallel };
+    for(int i=0; i<2; ++i){
+      players[i]->bVerbose = false;
+      players[i]->maxMoveDepth = 4;
+      players[i]->timeManager.baseMS = 1e9;
+    }
+    b1.Reset();
+    b1.SetRow(0, 1, 2, 3, 0);
+    b1.SetRow(1, 0, 1, 0, 0);
+    b1.score = 16;
+    assert(serial.FindBestMove(b1) == parallel.FindBestMove(b1));
+    assert(serial.stats.nodes == parallel.stats.nodes && serial.stats.moveDepth == 4);
+    serial.SetMemoryBudget(1);
+    parallel.SetMemoryBudget(1);
+    serial.maxMoveDepth = parallel.maxMoveDepth = 99;
+    assert(serial.FindBestMove(b1) == parallel.FindBestMove(b1));
+    assert(serial.stats.bBudgetHit && parallel.stats.bBudgetHit);
+    assert(serial.stats.moveDepth == parallel.stats.moveDepth);
+  }
+
+  // Test that TimeManager stops early on a dominant move, extends a close
+  // call, and gives nothing past the first ply once the game budget is spent
+  {
+    TimeManager tm;
+    tm.baseMS = 100.0;
+    b1.Reset();
+    b1.SetRow(0, 1, 2, 3, 0);
+    tm.StartMove(b1, 4);
+    assert(tm.softMS > 0.0 && tm.hardMS > tm.softMS);
+    assert(!tm.WantsGaps(0.0) && tm.WantsGaps(tm.softMS * 0.5));
+    assert(!tm.ShouldContinue(tm.softMS * 0.5, 0.2f, 0.0f));
+    assert(!tm.ShouldContinue(tm.softMS * 0.5, 0.0f, 5.0f));
+    assert(tm.ShouldContinue(tm.softMS * 0.5, 0.02f, 0.5f));
+    assert(!tm.ShouldContinue(tm.softMS * 1.5, 0.02f, 0.5f));
+    assert(tm.ShouldContinue(tm.softMS * 1.5, 0.0f, 0.01f));
+    tm.gameBudgetMS = 1000.0;
+    tm.NewGame();
+    tm.EndMove(1000.0);
+    tm.StartMove(b1, 4);
+    assert(tm.hardMS == 0.0 && tm.OutOfTime(0.0));
+  }
+
+  // Test that a search still moves when the budget can't hold even the
+  // root's moves
+  {
+    ThreadPool pool(1);
+    SearchPlayer player(&pool);
+    player.bVerbose = false;
+    player.timeManager.baseMS = 1e9;
+    player.SetMemoryBudget(0);
+    b1.Reset();
+    b1.SetRow(0, 1, 2, 3, 0);
+    b1.SetRow(1, 0, 1, 0, 0);
+    Direction move = player.FindBestMove(b1);
+    assert(move != None && b1.CanSlide(move) && player.stats.bBudgetHit);
+    player.SetMemoryBudget(1024);
+    player.maxNodes = 1;
+    move = player.FindBestMove(b1);
+    assert(move != None && b1.CanSlide(move) && player.stats.moveDepth == 1);
+    (void)move; // only asserted
+  }
+
+  // Test that a pondered spawn is answered with the move a search would
+  // find, and that a spawn missed by the pondering is searched
+  {
+    ThreadPool pool(1);
+    SearchPlayer ponderer(&pool), searcher(&pool);
+    SearchPlayer* players[2] = { &ponderer, &searcher };
+    for(int i=0; i<2; ++i){
+      players[i]->bVerbose = false;
+      players[i]->maxMoveDepth = 2;
+      players[i]->timeManager.baseMS = 1e9;
+    }
+    ponderer.SetPondering(true);
+    b1.Reset();
+    b1.SetRow(0, 1, 2, 3, 0);
+    b1.SetRow(1, 0, 1, 0, 0);
+    b1.score = 16;
+    const Direction first = ponderer.FindBestMove(b1);
+    ponderer.FinishPondering();
+    b1.Slide(first);
+    b2 = b1;
+    byte open[16];
+    b2.GetAvailableTiles(open);
+    b2.SetCell(open[0], 2);
+    Direction move = ponderer.FindBestMove(b2);
+    assert(ponderer.stats.bPondered && move == searcher.FindBestMove(b2));
+    ponderer.FinishPondering();
+    b2.Reset();
+    b2.SetRow(0, 3, 2, 1, 0);
+    move = ponderer.FindBestMove(b2);
+    assert(!ponderer.stats.bPondered && move == searcher.FindBestMove(b2));
+    ponderer.SetPondering(false);
+    (void)move; // only asserted
+  }
+
+  // Test that a position suite survives a save and load, and that a move
+  // equivalent to the reference move agrees with it
+  {
+    PositionSuite suite;
+    SuitePosition pos;
+    pos.board.Reset();
+    pos.board.SetRow(0, 1, 0, 0, 1);
+    pos.board.score = 8;
+    pos.phase = PhaseOf(pos.board);
+    pos.best = Up;
+    for(int d=0; d<NumDirections; ++d){
+      pos.score[d] = -std::numeric_limits<float>::infinity();
+      pos.probDeath[d] = 1.0f;
+    }
+    pos.score[Left] = pos.score[Right] = 1.5f;
+    pos.score[Down] = -2.25f;
+    pos.score[Up] = 0.0f; // not legal, but saved as a value
+    pos.probDeath[Left] = pos.probDeath[Right] = pos.probDeath[Down] = 0.125f;
+    suite.positions.push_back(pos);
+    const bool bSaved = suite.Save("suite_test.txt");
+    assert(bSaved);
+    (void)bSaved; // only asserted
+    PositionSuite loaded;
+    const bool bLoaded = loaded.Load("suite_test.txt");
+    assert(bLoaded);
+    (void)bLoaded; // only asserted
+    remove("suite_test.txt");
+    assert(loaded.positions.size() == 1);
+#ifndef NDEBUG
+    const SuitePosition& p = loaded.positions[0];
+#endif
+    assert(p.board == pos.board && p.board.score == 8 && p.phase == Early && p.best == Up);
+    assert(p.score[Down] == -2.25f && p.probDeath[Left] == 0.125f && p.score[Up] == 0.0f);
+    loaded.positions[0].best = Left;
+    assert(PositionSuite::Agrees(loaded.positions[0], Right));
+    assert(!PositionSuite::Agrees(loaded.positions[0], Down));
+  }
+
+  // Test that players searching side by side each get their fixed budget
+  // in wall time, as the suite's reference searches need
+  {
+    ThreadPool pool(2);
+    SearchPlayerSet players(pool.NumThreads(), 512);
+    players.SetBudget(20.0, 0, true);
+    Board boards[2];
+    boards[0].SetRow(0, 1, 2, 3, 4);
+    boards[0].SetRow(1, 0, 1, 0, 2);
+    boards[1].SetRow(0, 2, 0, 0, 1);
+    boards[1].SetRow(1, 3, 1, 0, 0);
+    boards[0].score = boards[1].score = 100;
+    pool.ParallelFor(2, 1, [&](size_t begin, size_t end, int iThread) {
+      for(size_t i=begin; i<end; ++i){
+#ifndef NDEBUG
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+#endif
+        players[iThread].FindBestMove(boards[i]);
+#ifndef NDEBUG
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        const SearchPlayer& p = players[iThread];
+#endif
+        assert(p.stats.bBudgetHit || ms >= p.timeManager.softMS);
+        assert(p.stats.ms <= ms);
+      }
+    });
+  }
+
+  // Test that a recorded game replays in the analyzer, and that a record
+  // with an illegal move is caught
+  {
+    RandomPlayer random;
+    GameRecord record;
+    const GameResult r = BatchRunner::PlayGame(&random, 7, &record.moves);
+    record.seed = 7;
+    assert((int)record.moves.size() == r.moves);
+    (void)r; // only asserted
+    GameRecord parsed;
+    assert(GameRecord::Parse((record.Format() + "\n").c_str(), &parsed));
+    assert(parsed.seed == 7 && parsed.moves == record.moves);
+    assert(!GameRecord::Parse("7 LRX", &parsed));
+
+    FILE* in = tmpfile();
+    FILE* out = tmpfile();
+    fprintf(in, "%s\nnot a record\n3 UUUUUUUUUUUUUUUU\n%s\n", record.Format().c_str(), record.Format().c_str());
+    rewind(in);
+    GameAnalyzer analyzer;
+    analyzer.maxDepth = 1;
+    analyzer.numThreads = 2;
+    analyzer.memoryMB = 64;
+    analyzer.batchPositions = 16; // games span batches
+    analyzer.Run(in, out);
+    assert(analyzer.stats.nGames == 3 && analyzer.stats.nBadGames == 1);
+    assert(analyzer.stats.nMoves >= r.moves && analyzer.stats.nSearched > 0);
+
+    rewind(out);
+    char line[256];
+    unsigned int seed;
+    int nMoves, score, nBad = 0, nGood = 0;
+    while(fgets(line, sizeof(line), out) != NULL){
+      if (sscanf(line, "game %u %d %d", &seed, &nMoves, &score) == 3) {
+        assert(seed == 7 && nMoves == r.moves && score == r.score);
+        ++nGood;
+      } else if (sscanf(line, "game %u bad %d", &seed, &nMoves) == 2) {
+        assert(seed == 3 && nMoves > 0);
+        ++nBad;
+      }
+    }
+    assert(nGood == 2 && nBad == 1);
+    fclose(in);
+    fclose(out);
+  }
+
+  // Test that big blocks come back usable in every page mode, whatever the
+  // OS grants, and are counted until freed
+  {
+    const PageMode mode = GetPageMode();
+    ThreadPool pool(2);
+    for(int m=NormalPages; m<=ExplicitPages; ++m){
+      SetPageMode((PageMode)m);
+#ifndef NDEBUG
+      const size_t before = pageStats.bytes;
+#endif
+      PageVector<uint64_t> v;
+      v.reserve(3 * LargeBlockBytes / sizeof(uint64_t));
+      assert(pageStats.bytes >= before + 3 * LargeBlockBytes);
+      FirstTouch(&pool, v.data(), v.data() + v.capacity());
+      v.resize(v.capacity(), 7);
+      assert(v.back() == 7);
+      std::vector<size_t> counts;
+      if (PagesByNode(v.data(), v.size() * sizeof(uint64_t), &counts)) {
+        size_t n = 0;
+        for(size_t i=0; i<counts.size(); ++i) n += counts[i];
+        assert(n > 0);
+      }
+      PageVector<uint64_t>().swap(v);
+      assert(pageStats.bytes == before);
+    }
+    SetPageMode(mode);
+  }
+
+  // Test that MctsPlayer picks legal moves, with an arena resized between
+  // moves and one too small to expand past the root
+  {
+    MctsPlayer mcts(2);
+    mcts.bVerbose = false;
+    mcts.maxRollouts = 200;
+    const int arenas[3] = { 64, 1 << 16, 8 };
+    for(int i=0; i<3; ++i){
+      mcts.maxNodes = arenas[i];
+      b1.Reset();
+      b1.SetRow(0, 1, 2, 3, 0);
+      b1.SetRow(1, 0, 1, 0, 0);
+      const Direction move = mcts.FindBestMove(b1);
+      assert(move != None && b1.CanSlide(move));
+      (void)move; // only asserted
+    }
+  }
+}